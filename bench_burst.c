@@ -0,0 +1,109 @@
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Measures thread_create latency during bursts of creates, with stacks
+ * allocated at create time and with lazy stacks, which are only allocated
+ * when a thread first runs. Each burst creates BURST threads back to back.
+ * Half of the bursts are then run to completion, and the other half are
+ * killed before any of their threads run. Each mode runs in a child process
+ * of its own, because the stack mode is set up by thread_init_options.
+ *****************************************************************************/
+
+#define BURST 10000
+#define ROUNDS 10
+
+static long create_ns[BURST * ROUNDS];
+static Tid burst[BURST];
+
+static void
+short_thread(void *arg)
+{
+}
+
+static void
+run(const char *name, int stack_mmap, int stack_lazy)
+{
+	struct thread_options options = { 0 };
+	long t, sum = 0, run_ns = 0, kill_ns = 0;
+	int ii, jj;
+	Tid ret;
+
+	init_csc369_malloc(false);
+	options.max_threads = BURST + 1;
+	options.stack_mmap = stack_mmap;
+	options.stack_lazy = stack_lazy;
+	thread_init_options(&options);
+
+	for (ii = 0; ii < ROUNDS; ii++) {
+		for (jj = 0; jj < BURST; jj++) {
+			t = now_ns();
+			burst[jj] = thread_create(short_thread, NULL);
+			create_ns[ii * BURST + jj] = now_ns() - t;
+			assert(thread_ret_ok(burst[jj]));
+		}
+		t = now_ns();
+		if (ii % 2 == 0) {
+			while (thread_yield(THREAD_ANY) != THREAD_NONE)
+				;
+			run_ns += now_ns() - t;
+		} else {
+			for (jj = 0; jj < BURST; jj++) {
+				ret = thread_kill(burst[jj]);
+				assert(ret == burst[jj]);
+			}
+			/* let the killed threads be reaped */
+			while (thread_yield(THREAD_ANY) != THREAD_NONE)
+				;
+			kill_ns += now_ns() - t;
+		}
+	}
+
+	for (ii = 0; ii < BURST * ROUNDS; ii++) {
+		sum += create_ns[ii];
+	}
+	qsort(create_ns, BURST * ROUNDS, sizeof(*create_ns), cmp_long);
+	unintr_printf("%-14s %9.0f %9ld %9ld %9.0f %9.0f\n", name,
+		      (double)sum / (BURST * ROUNDS),
+		      create_ns[BURST * ROUNDS / 2],
+		      create_ns[BURST * ROUNDS * 99 / 100],
+		      (double)run_ns / (BURST * ROUNDS / 2),
+		      (double)kill_ns / (BURST * ROUNDS / 2));
+}
+
+int
+main(int argc, char **argv)
+{
+	static const struct {
+		const char *name;
+		int stack_mmap, stack_lazy;
+	} modes[] = {
+		{ "malloc369", 0, 0 },
+		{ "malloc369 lazy", 0, 1 },
+		{ "mmap", 1, 0 },
+		{ "mmap lazy", 1, 1 },
+	};
+	int ii, status;
+	pid_t pid;
+
+	install_fatal_handlers((void *)main);
+	unintr_printf("%d bursts of %d creates, ns per thread\n", ROUNDS, BURST);
+	unintr_printf("%-14s %9s %9s %9s %9s %9s\n", "stacks", "create",
+		      "p50", "p99", "run", "kill");
+	for (ii = 0; ii < sizeof(modes) / sizeof(*modes); ii++) {
+		fflush(stdout);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			run(modes[ii].name, modes[ii].stack_mmap,
+			    modes[ii].stack_lazy);
+			exit(0);
+		}
+		waitpid(pid, &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Measures how thread creation scales with the number of threads alive. The
+ * thread table is filled up to a given occupancy with sleeping threads, and
+ * then one more thread is created and exits, over and over. Only the time
+ * spent in thread_create() is counted: freeing a stack poisons it, which
+ * would hide everything else. With a free tid bitmap the cost should not
+ * depend on the occupancy.
+ *****************************************************************************/
+
+#define CHURNS 100000
+
+static Tid occupants[THREAD_MAX_THREADS];
+static struct wait_queue *queue;
+
+static void
+idle_thread(void *arg)
+{
+	thread_sleep(queue);
+	assert(0);
+}
+
+static void
+exiting_thread(void *arg)
+{
+	thread_exit(0);
+}
+
+static double
+churn(int occupied, bool run)
+{
+	long start, total = 0;
+	Tid ret;
+	long ii;
+	int jj;
+
+	for (jj = 0; jj < occupied; jj++) {
+		occupants[jj] = thread_create(idle_thread, NULL);
+		assert(thread_ret_ok(occupants[jj]));
+	}
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	for (ii = 0; ii < CHURNS; ii++) {
+		start = now_ns();
+		ret = thread_create(run ? exiting_thread : idle_thread, NULL);
+		total += now_ns() - start;
+		assert(thread_ret_ok(ret));
+		if (run) {
+			/* run it and let it exit */
+			ret = thread_wait(ret, NULL);
+		} else {
+			/* kill it without ever switching */
+			ret = thread_kill(ret);
+		}
+		assert(thread_ret_ok(ret));
+	}
+	for (jj = 0; jj < occupied; jj++) {
+		ret = thread_kill(occupants[jj]);
+		assert(ret == occupants[jj]);
+	}
+	return (double)total / CHURNS;
+}
+
+int
+main(int argc, char **argv)
+{
+	/* all threads but the initial one and the churned one */
+	static const int occupancy[] = { 0, THREAD_MAX_THREADS / 2,
+					 THREAD_MAX_THREADS - 2 };
+	int ii;
+
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+	queue = wait_queue_create();
+
+	unintr_printf("%9s %16s %16s\n", "occupied", "create ns (kill)",
+		      "create ns (exit)");
+	for (ii = 0; ii < sizeof(occupancy) / sizeof(*occupancy); ii++) {
+		double killed = churn(occupancy[ii], false);
+		double exited = churn(occupancy[ii], true);
+
+		unintr_printf("%9d %16.1f %16.1f\n", occupancy[ii], killed,
+			      exited);
+	}
+	return 0;
+}
@@ -0,0 +1,120 @@
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Compares per-thread stacks with copy-stack mode. A large number of threads
+ * are created and parked on a wait queue, then woken up and run once more,
+ * and the benchmark reports what that costs in time and memory. Then two
+ * threads hand the CPU back and forth to measure a single switch. Each mode
+ * runs in a child process of its own.
+ *
+ * usage: bench_copy_stack [nthreads]    (default 1000000)
+ *
+ * Per-thread stacks are run with at most 100000 threads, which already takes
+ * gigabytes of stack.
+ *****************************************************************************/
+
+#define OWN_MAX 100000
+#define SWITCHES 1000000
+
+static struct wait_queue *queue;
+static Tid pair[2];
+static long switches_left;
+
+static void
+parked_thread(void *arg)
+{
+	while (1) {
+		thread_sleep(queue);
+	}
+}
+
+static void
+pingpong_thread(void *arg)
+{
+	Tid other = pair[1 - (long)arg];
+
+	while (switches_left-- > 0) {
+		thread_yield(other);
+	}
+}
+
+static void
+run(int shared, long nthreads)
+{
+	struct thread_options options = { 0 };
+	struct thread_stack_usage usage;
+	long start, create, park, wake, rss_before, ii;
+
+	init_csc369_malloc(false);
+	options.max_threads = nthreads + 3;
+	options.stack_shared = shared;
+	thread_init_options(&options);
+	queue = wait_queue_create();
+
+	rss_before = rss();
+	start = now_ns();
+	for (ii = 0; ii < nthreads; ii++) {
+		assert(thread_ret_ok(thread_create(parked_thread, NULL)));
+	}
+	create = now_ns() - start;
+	start = now_ns();
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	park = now_ns() - start;
+	start = now_ns();
+	assert(thread_wakeup(queue, 1) == nthreads);
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	wake = now_ns() - start;
+	thread_stack_usage(&usage);
+
+	/* two threads switching directly, through the copier in shared mode */
+	for (ii = 0; ii < 2; ii++) {
+		pair[ii] = thread_create(pingpong_thread, (void *)ii);
+		assert(thread_ret_ok(pair[ii]));
+	}
+	switches_left = SWITCHES;
+	start = now_ns();
+	assert(thread_wait(pair[0], NULL) == pair[0]);
+	assert(thread_wait(pair[1], NULL) == pair[1]);
+
+	unintr_printf("%-8s %8ld %8.0f %8.0f %8.0f %8ld %8ld %8.0f\n",
+		      shared ? "shared" : "own", nthreads,
+		      (double)create / nthreads, (double)park / nthreads,
+		      (double)wake / nthreads, usage.committed / nthreads,
+		      (rss() - rss_before) / nthreads,
+		      (double)(now_ns() - start) / SWITCHES);
+	/* The threads stay parked: freeing this many stacks is slow. */
+}
+
+int
+main(int argc, char **argv)
+{
+	long nthreads = argc > 1 ? atol(argv[1]) : 1000000;
+	int shared, status;
+	pid_t pid;
+
+	install_fatal_handlers((void *)main);
+	unintr_printf("%-8s %8s %8s %8s %8s %8s %8s %8s\n", "stacks",
+		      "threads", "create", "park", "wake+run", "stack", "rss",
+		      "switch");
+	unintr_printf("%-8s %8s %8s %8s %8s %8s %8s %8s\n", "", "",
+		      "ns", "ns", "ns", "B/thread", "B/thread", "ns");
+	for (shared = 0; shared < 2; shared++) {
+		fflush(stdout);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			run(shared, shared || nthreads < OWN_MAX ?
+			    nthreads : OWN_MAX);
+			exit(0);
+		}
+		waitpid(pid, &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	return 0;
+}
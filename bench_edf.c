@@ -0,0 +1,141 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Measures heartbeat responders next to busy threads. A ticker thread wakes
+ * the responders every PERIOD, and each one must finish a little work within
+ * DEADLINE of being woken. They are woken with thread_wakeup first, and then
+ * with thread_wakeup_deadline. The benchmark reports how long responses took
+ * and how many missed the deadline.
+ *****************************************************************************/
+
+#define NHOG 4
+#define NRESPONDER 2
+#define PERIOD 2000 /* usecs between heartbeats */
+#define DEADLINE 500 /* usecs to respond in */
+#define WORK 50 /* usecs of work per response */
+#define BEATS 1000
+
+static struct wait_queue *queue;
+static volatile int stop;
+static bool use_deadline;
+static long woken_at;
+static long responses[BEATS * NRESPONDER];
+static int nresponses;
+
+static void
+hog_thread(void *arg)
+{
+	while (!stop)
+		;
+}
+
+static void
+responder_thread(void *arg)
+{
+	while (true) {
+		thread_sleep(queue);
+		if (stop) {
+			return;
+		}
+		spin(WORK);
+		interrupts_off();
+		responses[nresponses++] = now_ns() - woken_at;
+		interrupts_on();
+	}
+}
+
+static void
+ticker_thread(void *arg)
+{
+	long next = now_ns();
+	int beat;
+
+	for (beat = 0; beat < BEATS; beat++) {
+		next += PERIOD * 1000L;
+		while (now_ns() < next)
+			;
+		interrupts_off();
+		woken_at = now_ns();
+		if (use_deadline) {
+			thread_wakeup_deadline(queue, 1,
+					       woken_at + DEADLINE * 1000L);
+		} else {
+			thread_wakeup(queue, 1);
+		}
+		interrupts_on();
+	}
+}
+
+static void
+run(bool deadline)
+{
+	struct thread_deadline_stats before, after;
+	Tid child[NHOG + NRESPONDER + 1];
+	int ii, missed = 0;
+	Tid ret;
+
+	use_deadline = deadline;
+	stop = 0;
+	nresponses = 0;
+	thread_deadline_stats(&before);
+	for (ii = 0; ii < NRESPONDER; ii++) {
+		child[ii] = thread_create(responder_thread, NULL);
+		assert(thread_ret_ok(child[ii]));
+	}
+	/* let the responders go to sleep */
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	for (ii = NRESPONDER; ii < NRESPONDER + NHOG; ii++) {
+		child[ii] = thread_create(hog_thread, NULL);
+		assert(thread_ret_ok(child[ii]));
+	}
+	child[ii] = thread_create(ticker_thread, NULL);
+	assert(thread_ret_ok(child[ii]));
+	ret = thread_wait(child[ii], NULL);
+	assert(ret == child[ii]);
+	stop = 1;
+	thread_wakeup(queue, 1);
+	for (ii = 0; ii < NRESPONDER + NHOG; ii++) {
+		ret = thread_wait(child[ii], NULL);
+		assert(ret == child[ii]);
+	}
+	thread_deadline_stats(&after);
+
+	interrupts_off();
+	for (ii = 0; ii < nresponses; ii++) {
+		if (responses[ii] > DEADLINE * 1000L) {
+			missed++;
+		}
+	}
+	qsort(responses, nresponses, sizeof(*responses), cmp_long);
+	unintr_printf("%-16s %6d %8ld %8ld %8ld %8d %8ld\n",
+		      deadline ? "wakeup_deadline" : "wakeup", nresponses,
+		      responses[nresponses / 2] / 1000,
+		      responses[nresponses * 99 / 100] / 1000,
+		      responses[nresponses - 1] / 1000, missed,
+		      after.missed - before.missed);
+	interrupts_on();
+}
+
+int
+main(int argc, char **argv)
+{
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+	register_interrupt_handler(false);
+	queue = wait_queue_create();
+
+	unintr_printf("%d busy threads, %d responders, %d us deadline every "
+		      "%d us, %d us slices\n", NHOG, NRESPONDER, DEADLINE,
+		      PERIOD, SIG_INTERVAL);
+	unintr_printf("%-16s %6s %8s %8s %8s %8s %8s\n", "woken with",
+		      "resp", "p50 us", "p99 us", "max us", "late", "counted");
+	run(false);
+	run(true);
+	wait_queue_destroy(queue);
+	return 0;
+}
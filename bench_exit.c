@@ -0,0 +1,100 @@
+#include <sys/wait.h>
+#include <malloc.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Measures an exit-heavy workload with malloc369 in its checking mode, which
+ * tracks every block and poisons freed memory, and in its fast mode. Threads
+ * are spawned and exit one at a time, then in batches that are killed before
+ * they run. Stacks are not pooled, so every exit and kill frees a stack. Each
+ * mode runs in a child process of its own, because malloc369 is set up once.
+ *
+ * Freeing a whole batch of stacks lets glibc trim the top of its heap, and
+ * the next batch faults those pages back in. That costs the same in both
+ * modes and hides the difference between them, so each mode also runs with
+ * trimming turned off. Exits free one stack at a time, which never trims.
+ *****************************************************************************/
+
+#define SPAWNS 50000
+#define BATCH 100
+#define NO_TRIM (1 << 30) /* M_TRIM_THRESHOLD that keeps the heap */
+
+static void
+short_thread(void *arg)
+{
+}
+
+static void
+run(bool fast, bool trim)
+{
+	Tid batch[BATCH];
+	long start, start_mallocs, start_bytes, exits, kills;
+	long ii;
+	int jj;
+	Tid ret;
+
+	if (!trim) {
+		mallopt(M_TRIM_THRESHOLD, NO_TRIM);
+	}
+	init_csc369_malloc_mode(false, fast);
+	thread_init();
+	start_mallocs = get_current_num_mallocs();
+	start_bytes = get_current_bytes_malloced();
+
+	start = now_ns();
+	for (ii = 0; ii < SPAWNS; ii++) {
+		ret = thread_create(short_thread, NULL);
+		assert(thread_ret_ok(ret));
+		ret = thread_wait(ret, NULL);
+		assert(thread_ret_ok(ret));
+	}
+	exits = now_ns() - start;
+
+	start = now_ns();
+	for (ii = 0; ii < SPAWNS; ii += BATCH) {
+		for (jj = 0; jj < BATCH; jj++) {
+			batch[jj] = thread_create(short_thread, NULL);
+			assert(thread_ret_ok(batch[jj]));
+		}
+		for (jj = 0; jj < BATCH; jj++) {
+			ret = thread_kill(batch[jj]);
+			assert(ret == batch[jj]);
+		}
+	}
+	kills = now_ns() - start;
+
+	/* the counts are exact in both modes */
+	assert(get_current_num_mallocs() == start_mallocs);
+	assert(get_current_bytes_malloced() == start_bytes);
+	unintr_printf("%-10s %-5s %12.0f %12.0f\n", fast ? "fast" : "checking",
+		      trim ? "on" : "off",
+		      (double)SPAWNS * NSEC_PER_SEC / exits,
+		      (double)SPAWNS * NSEC_PER_SEC / kills);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ii, status;
+	pid_t pid;
+
+	install_fatal_handlers((void *)main);
+	unintr_printf("%d threads, %d byte stacks\n", SPAWNS, THREAD_MIN_STACK);
+	unintr_printf("%-10s %-5s %12s %12s\n", "malloc369", "trim", "exits/s",
+		      "kills/s");
+	for (ii = 0; ii < 4; ii++) {
+		fflush(stdout);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			run(ii >= 2, ii % 2 == 0);
+			exit(0);
+		}
+		waitpid(pid, &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	return 0;
+}
@@ -0,0 +1,98 @@
+#include <math.h>
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Checks the CPU shares that busy threads of different priorities get, with
+ * FIFO and with fair scheduling. Each thread counts how many times it reads
+ * the clock until a deadline, which is proportional to the CPU time it got.
+ * Under fair scheduling, the shares should follow the weights of the
+ * priorities (the Linux nice weights). Each scheduler runs in a child process
+ * of its own.
+ *****************************************************************************/
+
+#define DURATION 3000000 /* usecs per scheduler */
+#define NTENANT 4
+
+static const int prio[NTENANT] = { 0, 0, -5, 5 };
+static const int weight[NTENANT] = { 1024, 1024, 3121, 335 };
+
+static long deadline;
+static long work[NTENANT];
+
+static void
+tenant_thread(void *arg)
+{
+	long num = (long)arg;
+
+	while (now_ns() < deadline) {
+		work[num]++;
+	}
+}
+
+static void
+run(int scheduler)
+{
+	struct thread_options options = { 0 };
+	struct thread_attr attr;
+	Tid child[NTENANT];
+	long total = 0, weights = 0;
+	double share, want, err = 0;
+	int ii;
+	Tid ret;
+
+	init_csc369_malloc(false);
+	options.scheduler = scheduler;
+	thread_init_options(&options);
+	register_interrupt_handler(false);
+
+	deadline = now_ns() + DURATION * 1000L;
+	for (ii = 0; ii < NTENANT; ii++) {
+		thread_attr_init(&attr);
+		attr.priority = prio[ii];
+		child[ii] = thread_create_attr(&attr, tenant_thread,
+					       (void *)(long)ii);
+		assert(thread_ret_ok(child[ii]));
+	}
+	for (ii = 0; ii < NTENANT; ii++) {
+		ret = thread_wait(child[ii], NULL);
+		assert(ret == child[ii]);
+		total += work[ii];
+		weights += weight[ii];
+	}
+
+	unintr_printf("%s:\n", scheduler == THREAD_SCHED_FAIR ? "fair" : "fifo");
+	for (ii = 0; ii < NTENANT; ii++) {
+		share = 100.0 * work[ii] / total;
+		want = 100.0 * weight[ii] / weights;
+		unintr_printf("  prio %3d  weight %5d  want %5.1f%%  got %5.1f%%\n",
+			      prio[ii], weight[ii], want, share);
+		err = fmax(err, fabs(share - want) / want);
+	}
+	unintr_printf("  worst share off by %.1f%%\n", 100 * err);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int schedulers[] = { THREAD_SCHED_FIFO, THREAD_SCHED_FAIR };
+	int ii, status;
+	pid_t pid;
+
+	install_fatal_handlers((void *)main);
+	for (ii = 0; ii < sizeof(schedulers) / sizeof(*schedulers); ii++) {
+		fflush(stdout);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			run(schedulers[ii]);
+			exit(0);
+		}
+		waitpid(pid, &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	return 0;
+}
@@ -0,0 +1,68 @@
+#include <sys/resource.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Measures what synchronization objects cost in memory. The benchmark creates
+ * many locks and condition variables, reports how many bytes they take and
+ * how much the resident set grew, and destroys them again.
+ *****************************************************************************/
+
+#define NLOCKS 100000
+
+static struct lock *locks[NLOCKS];
+static struct cv *cvs[NLOCKS];
+
+/* peak resident set size in bytes */
+static long
+max_rss()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss * 1024L;
+}
+
+int
+main(int argc, char **argv)
+{
+	long start;
+	long rss_before, bytes;
+	double ns;
+	int ii;
+
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+
+	rss_before = max_rss();
+	start = now_ns();
+	for (ii = 0; ii < NLOCKS; ii++) {
+		locks[ii] = lock_create();
+		cvs[ii] = cv_create();
+	}
+	ns = (double)(now_ns() - start) / NLOCKS;
+	bytes = get_current_bytes_malloced();
+
+	/* every lock still works */
+	for (ii = 0; ii < NLOCKS; ii++) {
+		lock_acquire(locks[ii]);
+		cv_signal(cvs[ii], locks[ii]);
+		lock_release(locks[ii]);
+	}
+
+	unintr_printf("%d locks and %d cvs\n", NLOCKS, NLOCKS);
+	unintr_printf("malloced:   %ld bytes (%ld per lock + cv)\n",
+		      bytes, bytes / NLOCKS);
+	unintr_printf("rss growth: %ld KB\n", (max_rss() - rss_before) / 1024);
+	unintr_printf("create:     %.1f ns per lock + cv\n", ns);
+
+	for (ii = 0; ii < NLOCKS; ii++) {
+		cv_destroy(cvs[ii]);
+		lock_destroy(locks[ii]);
+	}
+	assert(get_current_bytes_malloced() == 0);
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Compares the scheduling policies on a mix of busy threads and interactive
+ * threads. The busy threads spin for the whole run. The interactive threads
+ * do a little work, then yield, and measure how long it takes to get the CPU
+ * back. The benchmark reports that wait, and how much work the busy threads
+ * got done, in calls to the clock. Each scheduler runs in a child process of
+ * its own.
+ *****************************************************************************/
+
+#define NHOG 4
+#define NINTERACTIVE 2
+#define DURATION 2000000 /* usecs per scheduler */
+#define WORK 20 /* usecs of work between yields */
+#define MAX_WAITS 200000
+
+static const char *names[] = {
+	[THREAD_SCHED_FIFO] = "fifo",
+	[THREAD_SCHED_MLFQ] = "mlfq",
+	[THREAD_SCHED_FAIR] = "fair",
+	[THREAD_SCHED_PRIO] = "prio",
+};
+
+static long deadline; /* in now_ns() time */
+static long waits[MAX_WAITS];
+static int nwaits;
+static long hog_work[NHOG];
+
+static void
+hog_thread(void *arg)
+{
+	long num = (long)arg;
+
+	while (now_ns() < deadline) {
+		hog_work[num]++;
+	}
+}
+
+static void
+interactive_thread(void *arg)
+{
+	long start;
+
+	while (now_ns() < deadline) {
+		spin(WORK);
+		start = now_ns();
+		thread_yield(THREAD_ANY);
+		interrupts_off();
+		if (nwaits < MAX_WAITS) {
+			waits[nwaits++] = now_ns() - start;
+		}
+		interrupts_on();
+	}
+}
+
+static void
+run(int scheduler)
+{
+	struct thread_options options = { 0 };
+	Tid child[NHOG + NINTERACTIVE];
+	long work = 0, min_work = -1;
+	int ii;
+	Tid ret;
+
+	init_csc369_malloc(false);
+	options.scheduler = scheduler;
+	thread_init_options(&options);
+	register_interrupt_handler(false);
+
+	deadline = now_ns() + DURATION * 1000L;
+	for (ii = 0; ii < NHOG; ii++) {
+		child[ii] = thread_create(hog_thread, (void *)(long)ii);
+		assert(thread_ret_ok(child[ii]));
+	}
+	for (ii = NHOG; ii < NHOG + NINTERACTIVE; ii++) {
+		child[ii] = thread_create(interactive_thread, NULL);
+		assert(thread_ret_ok(child[ii]));
+	}
+	for (ii = 0; ii < NHOG + NINTERACTIVE; ii++) {
+		ret = thread_wait(child[ii], NULL);
+		assert(ret == child[ii]);
+	}
+
+	interrupts_off();
+	for (ii = 0; ii < NHOG; ii++) {
+		work += hog_work[ii];
+		if (min_work < 0 || hog_work[ii] < min_work) {
+			min_work = hog_work[ii];
+		}
+	}
+	qsort(waits, nwaits, sizeof(*waits), cmp_long);
+	unintr_printf("%-6s %8d %8ld %8ld %8ld %10.0f %8.2f\n",
+		      names[scheduler], nwaits,
+		      waits[nwaits / 2] / 1000, waits[nwaits * 99 / 100] / 1000,
+		      waits[nwaits - 1] / 1000, (double)work / 1000000,
+		      (double)min_work * NHOG / work);
+	interrupts_on();
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int schedulers[] = { THREAD_SCHED_FIFO, THREAD_SCHED_PRIO,
+					  THREAD_SCHED_MLFQ, THREAD_SCHED_FAIR };
+	int ii, status;
+	pid_t pid;
+
+	install_fatal_handlers((void *)main);
+	unintr_printf("%d busy threads, %d interactive threads, %d us slices\n",
+		      NHOG, NINTERACTIVE, SIG_INTERVAL);
+	unintr_printf("%-6s %8s %8s %8s %8s %10s %8s\n", "sched", "yields",
+		      "p50 us", "p99 us", "max us", "busy Mops", "fairness");
+	for (ii = 0; ii < sizeof(schedulers) / sizeof(*schedulers); ii++) {
+		fflush(stdout);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			run(schedulers[ii]);
+			exit(0);
+		}
+		waitpid(pid, &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	return 0;
+}
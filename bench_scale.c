@@ -0,0 +1,83 @@
+#include <sys/resource.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Creates a large number of threads, parks them all on one wait queue, and
+ * wakes them all up again, to see how each step scales with the number of
+ * threads.
+ *
+ * usage: bench_scale [nthreads]    (default 500000)
+ *****************************************************************************/
+
+static struct wait_queue *queue;
+static long parked;
+
+static void
+parked_thread(void *arg)
+{
+	while (1) {
+		parked++;
+		thread_sleep(queue);
+	}
+}
+
+static void
+report(const char *what, long ns, long nthreads)
+{
+	unintr_printf("%-14s %8.3f s %8.1f ns/thread\n", what,
+		      (double)ns / NSEC_PER_SEC, (double)ns / nthreads);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_options options = { 0 };
+	struct rusage ru;
+	long nthreads = argc > 1 ? atol(argv[1]) : 500000;
+	long start, ii;
+	Tid ret;
+
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	options.max_threads = nthreads + 1;
+	thread_init_options(&options);
+	queue = wait_queue_create();
+	unintr_printf("%ld threads\n", nthreads);
+
+	start = now_ns();
+	for (ii = 0; ii < nthreads; ii++) {
+		ret = thread_create(parked_thread, NULL);
+		assert(ret == ii + 1);
+	}
+	report("create", now_ns() - start, nthreads);
+	ret = thread_create(parked_thread, NULL);
+	assert(ret == THREAD_NOMORE);
+
+	/* each thread runs for the first time and parks */
+	start = now_ns();
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	report("first run+park", now_ns() - start, nthreads);
+	assert(parked == nthreads);
+
+	start = now_ns();
+	ret = thread_wakeup(queue, 1);
+	report("wakeup all", now_ns() - start, nthreads);
+	assert(ret == nthreads);
+
+	start = now_ns();
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	report("run+park", now_ns() - start, nthreads);
+	assert(parked == 2 * nthreads);
+
+	getrusage(RUSAGE_SELF, &ru);
+	unintr_printf("max rss: %ld MB (%ld bytes/thread)\n",
+		      ru.ru_maxrss / 1024, ru.ru_maxrss * 1024 / nthreads);
+	/* The threads stay parked: tearing down this many stacks would take
+	 * far longer than the rest of the benchmark. */
+	return 0;
+}
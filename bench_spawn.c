@@ -0,0 +1,93 @@
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "stack.h"
+
+/******************************************************************************
+ * Measures spawn throughput for short-lived threads, with and without the
+ * stack pool. Each spawn creates a thread that returns right away, and waits
+ * for it. Threads are spawned one at a time, and in batches that are all
+ * alive at once. Each mode runs in a child process of its own, because the
+ * pool is set up by thread_init_options.
+ *****************************************************************************/
+
+#define SPAWNS 100000
+#define BATCH 100
+
+static void
+short_thread(void *arg)
+{
+}
+
+static void
+run(int pool_max)
+{
+	struct thread_options options = { 0 };
+	struct stack_stats st;
+	Tid batch[BATCH];
+	long start, one, batched;
+	long ii;
+	int jj;
+	Tid ret;
+
+	init_csc369_malloc(false);
+	options.stack_pool_max = pool_max;
+	thread_init_options(&options);
+
+	start = now_ns();
+	for (ii = 0; ii < SPAWNS; ii++) {
+		ret = thread_create(short_thread, NULL);
+		assert(thread_ret_ok(ret));
+		ret = thread_wait(ret, NULL);
+		assert(thread_ret_ok(ret));
+	}
+	one = now_ns() - start;
+
+	start = now_ns();
+	for (ii = 0; ii < SPAWNS; ii += BATCH) {
+		for (jj = 0; jj < BATCH; jj++) {
+			batch[jj] = thread_create(short_thread, NULL);
+			assert(thread_ret_ok(batch[jj]));
+		}
+		for (jj = 0; jj < BATCH; jj++) {
+			ret = thread_wait(batch[jj], NULL);
+			assert(ret == batch[jj]);
+		}
+	}
+	batched = now_ns() - start;
+
+	stack_get_stats(&st);
+	unintr_printf("%-14s %10.0f %10.0f %9.1f%%\n",
+		      pool_max ? "pooled" : "unpooled",
+		      (double)SPAWNS * NSEC_PER_SEC / one,
+		      (double)SPAWNS * NSEC_PER_SEC / batched,
+		      100.0 * st.reused / st.allocs);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* one stack for the one-at-a-time spawns, a whole batch otherwise */
+	static const int pool_max[] = { 0, BATCH };
+	int ii, status;
+	pid_t pid;
+
+	install_fatal_handlers((void *)main);
+	unintr_printf("%d spawns, batches of %d\n", SPAWNS, BATCH);
+	unintr_printf("%-14s %10s %10s %10s\n", "stack pool", "single/s",
+		      "batched/s", "reused");
+	for (ii = 0; ii < sizeof(pool_max) / sizeof(*pool_max); ii++) {
+		fflush(stdout);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			run(pool_max[ii]);
+			exit(0);
+		}
+		waitpid(pid, &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	return 0;
+}
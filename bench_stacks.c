@@ -0,0 +1,115 @@
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Compares what thread stacks cost in memory. Many threads each use a few
+ * kilobytes of stack and then go to sleep, with small malloc369 stacks, large
+ * malloc369 stacks, and large mmap stacks, which are also tried with the
+ * dead part of the sleepers' stacks reclaimed. The benchmark reports how much
+ * stack space was reserved, how much of it is backed by memory, and how much
+ * the resident set grew. Each mode runs in a child process of its own.
+ *
+ * usage: bench_stacks [nthreads]    (default 10000)
+ *****************************************************************************/
+
+#define BIG_STACK (1024 * 1024)
+#define DEPTH 16 /* frames of about 1 KB each */
+
+static struct wait_queue *queue;
+
+static void
+recurse(int depth)
+{
+	volatile char frame[1000];
+
+	frame[0] = depth;
+	if (depth > 0) {
+		recurse(depth - 1);
+	}
+	frame[sizeof(frame) - 1] = frame[0];
+}
+
+static void
+deep_thread(void *arg)
+{
+	recurse(DEPTH);
+	thread_sleep(queue);
+}
+
+static void
+run(const char *name, long stack_size, int stack_mmap, int reclaim,
+    long nthreads)
+{
+	struct thread_options options = { 0 };
+	struct thread_stack_usage usage;
+	long rss_before, ii;
+	Tid ret;
+
+	init_csc369_malloc(false);
+	options.max_threads = nthreads + 1;
+	options.stack_size = stack_size;
+	options.stack_mmap = stack_mmap;
+	thread_init_options(&options);
+	queue = wait_queue_create();
+
+	rss_before = rss();
+	for (ii = 0; ii < nthreads; ii++) {
+		ret = thread_create(deep_thread, NULL);
+		assert(thread_ret_ok(ret));
+	}
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	if (reclaim) {
+		thread_reclaim_stacks();
+	}
+	thread_stack_usage(&usage);
+	assert(usage.stacks == nthreads);
+	unintr_printf("%-16s %10ld %10ld %10ld %10ld\n", name,
+		      usage.reserved >> 20, usage.committed >> 20,
+		      (rss() - rss_before) >> 20, usage.committed / nthreads);
+	/* The threads stay asleep: freeing the malloc369 stacks would poison
+	 * every byte of them. */
+}
+
+int
+main(int argc, char **argv)
+{
+	static const struct {
+		const char *name;
+		long stack_size;
+		int stack_mmap;
+		int reclaim;
+	} modes[] = {
+		{ "malloc 32K", THREAD_MIN_STACK, 0, 0 },
+		{ "malloc 1M", BIG_STACK, 0, 0 },
+		{ "mmap 1M", BIG_STACK, 1, 0 },
+		{ "mmap 1M reclaim", BIG_STACK, 1, 1 },
+	};
+	long nthreads = argc > 1 ? atol(argv[1]) : 10000;
+	int ii, status;
+	pid_t pid;
+
+	install_fatal_handlers((void *)main);
+	unintr_printf("%ld threads, each using about %d KB of stack\n",
+		      nthreads, DEPTH + 1);
+	unintr_printf("%-16s %10s %10s %10s %10s\n", "stacks", "reserved",
+		      "committed", "rss", "committed");
+	unintr_printf("%-16s %10s %10s %10s %10s\n", "", "MB", "MB", "MB",
+		      "B/thread");
+	for (ii = 0; ii < sizeof(modes) / sizeof(*modes); ii++) {
+		fflush(stdout);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			run(modes[ii].name, modes[ii].stack_size,
+			    modes[ii].stack_mmap, modes[ii].reclaim, nthreads);
+			exit(0);
+		}
+		waitpid(pid, &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	return 0;
+}
@@ -0,0 +1,85 @@
+#include <ucontext.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "context.h"
+
+/******************************************************************************
+ * Measures the cost of a cooperative context switch. The initial thread and
+ * one child thread hand the CPU back and forth with thread_yield(tid), and
+ * then with thread_yield(THREAD_ANY).
+ *
+ * Besides the time per switch, the benchmark reports how many bytes of saved
+ * thread state every switch writes and reads. These are worked out from the
+ * size of the saved state, not measured. They are shown next to the old
+ * path, which called getcontext into a ucontext_t on the stack and then
+ * copied it into the thread's slot. Build with
+ * 'make CPPFLAGS=-DTHREAD_UCONTEXT' to compare with getcontext/setcontext.
+ *****************************************************************************/
+
+#define SWITCHES 2000000
+
+static Tid main_tid;
+static volatile int stop;
+
+static void
+partner_thread(void *arg)
+{
+	bool directed = (arg != NULL);
+
+	while (!stop) {
+		thread_yield(directed ? main_tid : THREAD_ANY);
+	}
+}
+
+static double
+run(bool directed)
+{
+	long start, ns;
+	Tid child;
+	long ii;
+
+	stop = 0;
+	child = thread_create(partner_thread, directed ? (void *)1 : NULL);
+	assert(thread_ret_ok(child));
+
+	start = now_ns();
+	for (ii = 0; ii < SWITCHES / 2; ii++) {
+		thread_yield(directed ? child : THREAD_ANY);
+	}
+	ns = now_ns() - start;
+
+	/* let the partner see the flag and exit */
+	stop = 1;
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	return (double)ns / SWITCHES;
+}
+
+int
+main(int argc, char **argv)
+{
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+	main_tid = thread_id();
+
+#ifdef THREAD_UCONTEXT
+	unintr_printf("switch: getcontext/setcontext\n");
+#else
+	unintr_printf("switch: context.S\n");
+#endif
+	/* The old path wrote the ucontext_t twice, on the stack and in the
+	 * slot, and read it twice, for the copy and for setcontext. */
+	unintr_printf("saved state per switch, from its size:\n");
+	unintr_printf("  copied via the stack (old): %5zu bytes written, "
+		      "%5zu bytes read\n",
+		      2 * sizeof(ucontext_t), 2 * sizeof(ucontext_t));
+	unintr_printf("  in place (this build):      %5zu bytes written, "
+		      "%5zu bytes read\n",
+		      sizeof(struct context), sizeof(struct context));
+	unintr_printf("yield(tid): %6.1f ns/switch\n", run(true));
+	unintr_printf("yield(ANY): %6.1f ns/switch\n", run(false));
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include <math.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Compares the timers that can drive preemption. Two threads split a fixed
+ * amount of busy work while timer interrupts switch between them. The
+ * benchmark reports how long the work took, and how regular the interrupts
+ * were. Then the initial thread spins alone for a second, which should cost
+ * no interrupts at all.
+ *
+ * usage: bench_timer [posix|itimer]
+ *****************************************************************************/
+
+#define WORK 400000000L /* loop iterations shared by the two threads */
+
+static volatile long sink;
+static volatile int finished;
+
+static void
+worker(void *arg)
+{
+	long ii;
+
+	for (ii = 0; ii < WORK / 2; ii++) {
+		sink++;
+	}
+	__sync_fetch_and_add(&finished, 1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct interrupt_stats st;
+	long start;
+	double mean, sd, secs;
+	long n;
+	bool itimer = (argc > 1 && strcmp(argv[1], "itimer") == 0);
+	Tid ret;
+
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	thread_init();
+	interrupts_use_timer(itimer ? INTERRUPT_TIMER_ITIMER
+			     : INTERRUPT_TIMER_POSIX);
+	register_interrupt_handler(false);
+
+	start = now_ns();
+	ret = thread_create(worker, NULL);
+	assert(thread_ret_ok(ret));
+	ret = thread_create(worker, NULL);
+	assert(thread_ret_ok(ret));
+	while (__sync_fetch_and_add(&finished, 0) < 2) {
+		thread_yield(THREAD_ANY);
+	}
+	secs = (double)(now_ns() - start) / NSEC_PER_SEC;
+
+	/* only one runnable thread: the timer should stay off */
+	spin(USEC_PER_SEC);
+
+	interrupts_get_stats(&st);
+	n = st.intervals;
+	mean = n > 0 ? (double)st.interval_sum_ns / n : 0;
+	sd = n > 0 ? sqrt(st.interval_sumsq / n - mean * mean) : 0;
+
+	unintr_printf("timer: %s, interval %d us\n",
+		      itimer ? "setitimer (one-shot)" : "timer_create (periodic)",
+		      SIG_INTERVAL);
+	unintr_printf("work time:  %.3f s\n", secs);
+	unintr_printf("ticks:      %ld (%.0f per second)\n",
+		      st.ticks, st.ticks / secs);
+	unintr_printf("overruns:   %ld\n", st.overruns);
+	unintr_printf("deferred:   %ld\n", st.deferred);
+	unintr_printf("avoided:    %ld (1 s alone: %d expected)\n",
+		      st.ticks_avoided, USEC_PER_SEC / SIG_INTERVAL);
+	unintr_printf("interval:   mean %.1f us, sd %.1f us, "
+		      "min %.1f us, max %.1f us\n",
+		      mean / 1000, sd / 1000, st.interval_min_ns / 1000.0,
+		      st.interval_max_ns / 1000.0);
+	return 0;
+}
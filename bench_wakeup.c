@@ -0,0 +1,73 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Exercises the scheduler's own bookkeeping over many threads. A large number
+ * of threads sleep on one wait queue. Each round wakes them all up, which
+ * walks every thread's queue links, and then runs them all so that they go
+ * back to sleep. The wakeup only needs the small scheduling part of each
+ * thread control block, so its cost shows how densely that part is packed.
+ *
+ * There is no hardware counter access here: run it under
+ * 'perf stat -e cache-misses,cache-references' to count cache misses.
+ *
+ * usage: bench_wakeup [nthreads]    (default 200000)
+ *****************************************************************************/
+
+#define ROUNDS 20
+
+static struct wait_queue *queue;
+
+static void
+sleeper_thread(void *arg)
+{
+	while (1) {
+		thread_sleep(queue);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_options options = { 0 };
+	long nthreads = argc > 1 ? atol(argv[1]) : 200000;
+	long start, wakeup_ns = 0, run_ns = 0;
+	long ii;
+	int round;
+	Tid ret;
+
+	install_fatal_handlers((void *)main);
+	init_csc369_malloc(false);
+	options.max_threads = nthreads + 1;
+	thread_init_options(&options);
+	queue = wait_queue_create();
+
+	for (ii = 0; ii < nthreads; ii++) {
+		ret = thread_create(sleeper_thread, NULL);
+		assert(thread_ret_ok(ret));
+	}
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+
+	for (round = 0; round < ROUNDS; round++) {
+		start = now_ns();
+		ret = thread_wakeup(queue, 1);
+		wakeup_ns += now_ns() - start;
+		assert(ret == nthreads);
+
+		start = now_ns();
+		while (thread_yield(THREAD_ANY) != THREAD_NONE)
+			;
+		run_ns += now_ns() - start;
+	}
+
+	unintr_printf("%ld threads, %d rounds\n", nthreads, ROUNDS);
+	unintr_printf("wakeup:   %6.1f ns/thread\n",
+		      (double)wakeup_ns / ROUNDS / nthreads);
+	unintr_printf("run+park: %6.1f ns/thread\n",
+		      (double)run_ns / ROUNDS / nthreads);
+	/* The threads stay asleep: freeing this many stacks is slow. */
+	return 0;
+}
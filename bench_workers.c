@@ -0,0 +1,139 @@
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/******************************************************************************
+ * Measures how M:N mode scales with the number of workers. First, busy
+ * threads split a fixed amount of work, which needs the library only when
+ * timer interrupts preempt them: the speedup over one worker is bounded by
+ * the number of CPUs. Then threads take turns on a lock with lock_acquire
+ * and lock_release, which all go through the scheduler lock. Each worker
+ * count runs in a child process of its own.
+ *
+ * usage: bench_workers [max workers]    (default: the number of CPUs)
+ *****************************************************************************/
+
+#define NCHILD 16
+#define WORK 400000000L /* loop iterations shared by the busy threads */
+#define LOCK_DURATION 500000 /* usecs of lock traffic */
+
+static long deadline; /* in now_ns() time */
+static struct lock *lock;
+static long lock_ops[NCHILD];
+
+static void
+busy_thread(void *arg)
+{
+	volatile long sink = 0;
+	long ii;
+
+	for (ii = 0; ii < WORK / NCHILD; ii++) {
+		sink++;
+	}
+}
+
+static void
+lock_thread(void *arg)
+{
+	long num = (long)arg;
+
+	while (now_ns() < deadline) {
+		lock_acquire(lock);
+		lock_ops[num]++;
+		lock_release(lock);
+	}
+}
+
+/* Runs NCHILD threads of fn, and returns how long they took, in secs. */
+static double
+run_all(void (*fn)(void *))
+{
+	Tid child[NCHILD];
+	long start = now_ns();
+	long ii;
+	Tid ret;
+
+	for (ii = 0; ii < NCHILD; ii++) {
+		child[ii] = thread_create(fn, (void *)ii);
+		assert(thread_ret_ok(child[ii]));
+	}
+	for (ii = 0; ii < NCHILD; ii++) {
+		ret = thread_wait(child[ii], NULL);
+		assert(ret == child[ii]);
+	}
+	return (double)(now_ns() - start) / NSEC_PER_SEC;
+}
+
+/* Writes the busy time to out, for the speedups of the next runs. */
+static void
+run(int workers, double base, int out)
+{
+	struct thread_options options = { 0 };
+	double busy_secs, lock_secs;
+	long ops = 0;
+	ssize_t ret;
+	int ii;
+
+	init_csc369_malloc(false);
+	options.workers = workers;
+	thread_init_options(&options);
+	register_interrupt_handler(false);
+
+	busy_secs = run_all(busy_thread);
+	lock = lock_create();
+	deadline = now_ns() + LOCK_DURATION * 1000L;
+	lock_secs = run_all(lock_thread);
+	for (ii = 0; ii < NCHILD; ii++) {
+		ops += lock_ops[ii];
+	}
+	unintr_printf("%7d %9.3f %8.2f %12.2f\n", workers, busy_secs,
+		      base > 0 ? base / busy_secs : 1.0,
+		      ops / lock_secs / 1000000);
+	ret = write(out, &busy_secs, sizeof(busy_secs));
+	assert(ret == sizeof(busy_secs));
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_workers = argc > 1 ? atoi(argv[1]) :
+		sysconf(_SC_NPROCESSORS_ONLN);
+	int fd[2], workers, status, ret;
+	double base = 0;
+	pid_t pid;
+
+	install_fatal_handlers((void *)main);
+	if (max_workers < 1) {
+		max_workers = 1;
+	}
+	unintr_printf("%d threads, %ld CPUs online\n", NCHILD,
+		      sysconf(_SC_NPROCESSORS_ONLN));
+	unintr_printf("%7s %9s %8s %12s\n", "workers", "busy s", "speedup",
+		      "lock Mops/s");
+	for (workers = 1; workers <= max_workers; workers++) {
+		double secs;
+
+		ret = pipe(fd);
+		assert(ret == 0);
+		fflush(stdout);
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			close(fd[0]);
+			run(workers, base, fd[1]);
+			exit(0);
+		}
+		close(fd[1]);
+		waitpid(pid, &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		ret = read(fd[0], &secs, sizeof(secs));
+		assert(ret == sizeof(secs));
+		close(fd[0]);
+		if (workers == 1) {
+			base = secs;
+		}
+	}
+	return 0;
+}
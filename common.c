@@ -18,6 +18,39 @@ timespec_sub(const struct timespec *a, const struct timespec *b)
 	return r;
 }
 
+/* Returns the time of CLOCK_MONOTONIC in nanoseconds. */
+long
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Compares two longs, for qsort(). */
+int
+cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Returns the resident set size of this process in bytes. */
+long
+rss(void)
+{
+	FILE *statm = fopen("/proc/self/statm", "r");
+	long size, resident = 0;
+
+	assert(statm);
+	if (fscanf(statm, "%ld %ld", &size, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(statm);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
 /* Busy wait for the given number of microseconds */
 void
 spin(unsigned long usecs)
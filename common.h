@@ -20,6 +20,15 @@
 /* Returns the result of a - b as a struct timespec. */
 extern struct timespec timespec_sub(const struct timespec *a, const struct timespec *b);
 
+/* Returns the time of CLOCK_MONOTONIC in nanoseconds. */
+extern long now_ns(void);
+
+/* Compares two longs, for qsort(). */
+extern int cmp_long(const void *a, const void *b);
+
+/* Returns the resident set size of this process in bytes. */
+extern long rss(void);
+
 /* Delay (busy wait) for the given number of microseconds */ 
 extern void spin(unsigned long usecs);
 
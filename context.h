@@ -0,0 +1,134 @@
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef THREAD_UCONTEXT
+
+/* Saved machine state of a thread that is switched out.
+ *
+ * A switch always happens through a function call, so only the registers the
+ * x86-64 System V ABI requires a callee to preserve need to be kept: rbx, rbp,
+ * r12-r15, the stack pointer, and the control bits of mxcsr and the x87 control
+ * word. Everything else is either dead or already spilled by the caller.
+ *
+ * Unlike getcontext/setcontext, the signal mask is not part of the context.
+ * Threads only ever switch with interrupts disabled, and every thread restores
+ * its own interrupt state after it is switched back in, so there is nothing to
+ * save and no sigprocmask system call on the switch path.
+ *
+ * The field offsets are hard coded in context.S.
+ */
+struct context {
+	uint64_t rbx;		/* 0 */
+	uint64_t rbp;		/* 8 */
+	uint64_t r12;		/* 16 */
+	uint64_t r13;		/* 24 */
+	uint64_t r14;		/* 32 */
+	uint64_t r15;		/* 40 */
+	void *rsp;		/* 48 */
+	void *rip;		/* 56 */
+	uint32_t mxcsr;		/* 64 */
+	uint16_t fpucw;		/* 68 */
+};
+
+_Static_assert(offsetof(struct context, rsp) == 48, "context.S offsets");
+_Static_assert(offsetof(struct context, rip) == 56, "context.S offsets");
+_Static_assert(offsetof(struct context, mxcsr) == 64, "context.S offsets");
+_Static_assert(offsetof(struct context, fpucw) == 68, "context.S offsets");
+
+/* Save the current context into 'from' and resume the context in 'to'. Returns
+ * when some other thread switches back to 'from'.
+ */
+void context_switch(struct context *from, struct context *to);
+
+/* Resume the context in 'to' without saving the current one. */
+void context_load(struct context *to) __attribute__((noreturn));
+
+/* First code run by a new context. Calls r12(r13, r14). */
+void context_entry(void);
+
+/* Set up ctx so that switching to it calls entry(fn, arg) on the given stack.
+ * entry must never return.
+ */
+static inline void
+context_init(struct context *ctx, void *stack, size_t size,
+	     void (*entry)(void (*)(void *), void *),
+	     void (*fn)(void *), void *arg)
+{
+	uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+
+	*ctx = (struct context){ 0 };
+	ctx->r12 = (uint64_t)entry;
+	ctx->r13 = (uint64_t)fn;
+	ctx->r14 = (uint64_t)arg;
+	ctx->rsp = (void *)top;
+	ctx->rip = (void *)context_entry;
+	ctx->mxcsr = 0x1f80;	/* power-on defaults: all exceptions masked */
+	ctx->fpucw = 0x037f;
+}
+
+/* The stack pointer a switched-out context resumes with. */
+static inline void *
+context_sp(const struct context *ctx)
+{
+	return ctx->rsp;
+}
+
+#else /* THREAD_UCONTEXT */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+/* The getcontext/setcontext fallback. Contexts are always captured straight
+ * into the thread's own struct context: a ucontext_t points into itself
+ * (uc_mcontext.fpregs), so a copy made after getcontext is not safe to resume.
+ */
+struct context {
+	ucontext_t uc;
+};
+
+/* Always inlined so that, like with context.S, the saved context resumes in
+ * the caller's frame rather than in a wrapper frame the caller may since have
+ * overwritten. thread_exit resumes the main thread's context more than once.
+ */
+static inline void __attribute__((always_inline))
+context_switch(struct context *from, struct context *to)
+{
+	int ret = swapcontext(&from->uc, &to->uc);
+	assert(!ret);
+}
+
+static inline void __attribute__((noreturn))
+context_load(struct context *to)
+{
+	setcontext(&to->uc);
+	abort();
+}
+
+static inline void
+context_init(struct context *ctx, void *stack, size_t size,
+	     void (*entry)(void (*)(void *), void *),
+	     void (*fn)(void *), void *arg)
+{
+	/* Enter with the stack aligned as if entry had just been called. */
+	uintptr_t top = (((uintptr_t)stack + size) & ~(uintptr_t)15) - 8;
+	int ret = getcontext(&ctx->uc);
+	assert(!ret);
+	ctx->uc.uc_mcontext.gregs[REG_RSP] = (greg_t)top;
+	ctx->uc.uc_mcontext.gregs[REG_RIP] = (greg_t)entry;
+	ctx->uc.uc_mcontext.gregs[REG_RDI] = (greg_t)fn;
+	ctx->uc.uc_mcontext.gregs[REG_RSI] = (greg_t)arg;
+}
+
+static inline void *
+context_sp(const struct context *ctx)
+{
+	return (void *)ctx->uc.uc_mcontext.gregs[REG_RSP];
+}
+
+#endif /* THREAD_UCONTEXT */
+
+#endif /* _CONTEXT_H_ */
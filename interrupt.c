@@ -1,12 +1,17 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sched.h>
 #include <ucontext.h>
 #include <stdarg.h>
 #include <string.h>
 #include "common.h"
 #include "interrupt.h"
 
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid /* missing in older glibc */
+#endif
+
 /* This is the function that will handle timer signals (i.e., the interrupt
  * handler). See 'man sigaction' for an explanation of the arguments.
  */
@@ -15,14 +20,62 @@ static void interrupt_handler(int sig, siginfo_t * sip, void *contextVP);
 /* This function sets up a timer to deliver a signal to the process. 
  * These timer signals are the interrupts for the user-level threads.
  */
+static void start_timer();
+
+/* Re-arms the one-shot INTERRUPT_TIMER_ITIMER timer. */
 static void set_interrupt();
 
-/* This function initializes signal set pointed to by setp so that only the 
- * signal used for the timer is included in the set.
- */
-static void set_signal(sigset_t * setp);
+/* Accounts for one timer signal in stats. */
+static int count_tick(siginfo_t * sip);
+
+/* Stops the timer until interrupts_arm() is called. */
+static void disarm_timer();
+
+/* Ticks the stopped timer would have sent by now. */
+static long ticks_avoided_since(const struct timespec *now);
+
+/* Takes sched_lock, spinning until it is free. */
+static void lock_sched();
+
+/* Disables interrupts, which are enabled. */
+static inline void preempt_off() __attribute__((always_inline));
+
+/* Enables interrupts, which are disabled, without running pending ticks. */
+static inline void preempt_on() __attribute__((always_inline));
 
 static bool loud = false; /* print info from interrupt handler? */ 
+static enum interrupt_timer timer_kind = INTERRUPT_TIMER_POSIX;
+static bool registered = false;
+/* Every kernel thread that runs threads has a timer of its own, which only
+ * interrupts that kernel thread, and keeps its own statistics. */
+static __thread timer_t posix_timer;
+static __thread bool posix_timer_created = false;
+static __thread struct interrupt_stats stats;
+static __thread struct timespec last_tick;
+static __thread bool armed = false;
+static __thread struct timespec disarmed_at;
+
+/* Interrupts are disabled in user space instead of by blocking SIG_TYPE, which
+ * would cost a sigprocmask system call every time. While preempt_disabled is
+ * set, a timer signal only adds its ticks to preempt_pending, and they are
+ * charged to the running thread when interrupts are enabled again.
+ *
+ * A flag is enough: callers nest by saving the value interrupts_set returns
+ * and passing it back, and threads always switch with interrupts disabled.
+ * Each kernel thread has its own.
+ */
+static __thread volatile sig_atomic_t preempt_disabled;
+static __thread volatile sig_atomic_t preempt_pending;
+/* An interrupts_kick() arrived while interrupts were off. */
+static __thread volatile sig_atomic_t preempt_kicked;
+
+/* After interrupts_use_lock(), disabling interrupts also takes sched_lock, so
+ * only one kernel thread at a time runs with interrupts disabled. The lock
+ * belongs to no thread: one that switches with interrupts disabled hands it
+ * to the thread it switches to, which releases it.
+ */
+static bool use_lock;
+static int sched_lock;
 
 /* Test programs will call this function after initializing the threads package.
  * Many of the calls won't make sense at first -- study the man pages! 
@@ -55,8 +108,14 @@ register_interrupt_handler(bool verbose)
 	error = sigemptyset(&action.sa_mask);
 	assert(!error);
 
-	/* Use sa_sigaction field as handler instead of sa_handler field. */
-	action.sa_flags = SA_SIGINFO;
+	/* Use sa_sigaction field as handler instead of sa_handler field.
+	 * SA_NODEFER: SIG_TYPE is never blocked, not even while the handler
+	 * runs. A thread the handler switches to would otherwise keep running
+	 * with the signal blocked. Recursive interrupts are deferred through
+	 * preempt_disabled instead. SA_RESTART: the signal now also arrives
+	 * while interrupts are off, e.g., during the write() in unintr_printf.
+	 */
+	action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_RESTART;
 
 	/* Install the signal handler. */
 	if (sigaction(SIG_TYPE, &action, NULL)) {
@@ -65,7 +124,78 @@ register_interrupt_handler(bool verbose)
 	}
 
 	/* Initialize the timer. */
-	set_interrupt();
+	registered = true;
+	start_timer();
+}
+
+/* The timer only runs while some thread is waiting to run: an interrupt that
+ * finds no other thread to switch to stops it, unless the thread library
+ * still has periodic work to do. The library calls this function whenever a
+ * thread becomes ready, or such work comes up, to start the timer again. It
+ * is cheap when the timer is already running.
+ */
+void
+interrupts_arm()
+{
+	struct timespec now;
+
+	if (armed || !registered) {
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	stats.ticks_avoided += ticks_avoided_since(&now);
+	/* the gap is not an interval between two ticks */
+	last_tick = (struct timespec){ 0, 0 };
+	start_timer();
+}
+
+/* Selects the timer that delivers interrupts. Must be called before
+ * register_interrupt_handler().
+ */
+void
+interrupts_use_timer(enum interrupt_timer timer)
+{
+	timer_kind = timer;
+}
+
+/* Makes disabling interrupts also take a lock shared by all kernel threads,
+ * so that threads can run on more than one of them. Must be called with
+ * interrupts enabled, before a second kernel thread runs threads. Only the
+ * INTERRUPT_TIMER_POSIX timer can then be used.
+ */
+void
+interrupts_use_lock()
+{
+	assert(!preempt_disabled);
+	use_lock = true;
+}
+
+/* Interrupts the given kernel thread right away, for the thread library to
+ * look at the thread it runs, as at a tick. This is not counted or charged as
+ * a tick. Does nothing before register_interrupt_handler() is called.
+ */
+void
+interrupts_kick(pthread_t thread)
+{
+	if (registered) {
+		pthread_kill(thread, SIG_TYPE);
+	}
+}
+
+/* Copies the interrupt statistics gathered so far by the calling kernel
+ * thread into *out.
+ */
+void
+interrupts_get_stats(struct interrupt_stats *out)
+{
+	bool enabled = interrupts_off();
+	*out = stats;
+	if (registered && !armed) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		out->ticks_avoided += ticks_avoided_since(&now);
+	}
+	interrupts_set(enabled);
 }
 
 /* Enables interrupts. */
@@ -83,36 +213,43 @@ interrupts_off()
 }
 
 /* Enables or disables interrupts, and returns whether interrupts were enabled
- * or not previously. 
+ * or not previously. Enabling interrupts runs the yield of any interrupt that
+ * arrived while they were disabled.
  */
 bool
 interrupts_set(bool enable)
 {
-	int ret;
-	sigset_t mask, omask;
+	bool enabled = !preempt_disabled;
 
-	set_signal(&mask);
-	
-	if (enable) {
-		ret = sigprocmask(SIG_UNBLOCK, &mask, &omask);
-	} else {
-		ret = sigprocmask(SIG_BLOCK, &mask, &omask);
+	if (!enable) {
+		if (enabled) {
+			preempt_off();
+		}
+		return enabled;
 	}
-	assert(!ret);
-
-	return (sigismember(&omask, SIG_TYPE) ? false : true);
+	if (!enabled) {
+		preempt_on();
+	}
+	while (preempt_pending || preempt_kicked) {
+		long ticks;
+
+		preempt_off();
+		/* this call looks, whenever the kick came */
+		preempt_kicked = 0;
+		/* one step, or a tick the handler adds in between is lost */
+		ticks = __atomic_exchange_n(&preempt_pending, 0,
+					    __ATOMIC_SEQ_CST);
+		thread_tick(ticks * SIG_INTERVAL);
+		preempt_on();
+	}
+	return enabled;
 }
 
 /* Returns whether interrupts are currently enabled or not. */
 bool
 interrupts_enabled()
 {
-	sigset_t mask;
-	int ret;
-
-	ret = sigprocmask(0, NULL, &mask);
-	assert(!ret);
-	return (sigismember(&mask, SIG_TYPE) ? false : true);
+	return !preempt_disabled;
 }
 
 /* Disables output from interrupt handler function. */
@@ -148,18 +285,39 @@ unintr_printf(const char *fmt, ...)
 
 /* static functions */
 
-/* This function initializes signal set pointed to by setp so that only the 
- * signal used for the timer is included in the set.
- */
 static void
-set_signal(sigset_t * setp)
+lock_sched()
 {
-	int ret;
-	ret = sigemptyset(setp);
-	assert(!ret);
-	ret = sigaddset(setp, SIG_TYPE);
-	assert(!ret);
-	return;
+	int spins = 0;
+
+	while (__atomic_exchange_n(&sched_lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&sched_lock, __ATOMIC_RELAXED)) {
+			/* the holder may be waiting for our CPU */
+			if (++spins % 64 == 0) {
+				sched_yield();
+			}
+		}
+	}
+}
+
+static inline void
+preempt_off()
+{
+	preempt_disabled = 1;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	if (use_lock) {
+		lock_sched();
+	}
+}
+
+static inline void
+preempt_on()
+{
+	if (use_lock) {
+		__atomic_store_n(&sched_lock, 0, __ATOMIC_RELEASE);
+	}
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	preempt_disabled = 0;
 }
 
 static bool first = true;
@@ -173,11 +331,30 @@ static void
 interrupt_handler(int sig, siginfo_t * sip, void *contextVP)
 {
 	ucontext_t *context = (ucontext_t *) contextVP;
+	int ticks;
 
-	/* Check that SIG_TYPE is blocked on entry. 
-	 * This signal should be blocked because of the default signal 
-	 * handling behavior. */
-	assert(!interrupts_enabled());
+	if (sip->si_code == SI_TKILL) {
+		/* interrupts_kick(): a look at the thread, not a tick */
+		if (preempt_disabled) {
+			preempt_kicked = 1;
+			return;
+		}
+		preempt_off();
+		thread_tick(0);
+		interrupts_on();
+		return;
+	}
+	ticks = count_tick(sip);
+
+	/* Interrupts are off: charge the ticks once they are turned back on.
+	 * This also catches the handler interrupting itself. */
+	if (preempt_disabled) {
+		__atomic_fetch_add(&preempt_pending, ticks, __ATOMIC_SEQ_CST);
+		stats.deferred++;
+		set_interrupt();
+		return;
+	}
+	preempt_off();
 
 	if (loud) {
 		int ret;
@@ -208,8 +385,111 @@ interrupt_handler(int sig, siginfo_t * sip, void *contextVP)
 	/* Re-arm the timer to deliver the next interrupt */
 	set_interrupt();
 	
-	/* Implement preemptive threading by calling thread_yield. */
-	thread_yield(THREAD_ANY);
+	/* Implement preemptive threading: thread_tick yields once the running
+	 * thread has used up its time slice. */
+	if (thread_tick(ticks * SIG_INTERVAL) == THREAD_NONE && armed) {
+		/* Nobody else can run, so there is nothing to preempt. */
+		disarm_timer();
+	}
+	interrupts_on();
+}
+
+/* Returns the number of SIG_INTERVAL periods this signal stands for. */
+static int
+count_tick(siginfo_t * sip)
+{
+	struct timespec now, diff;
+	long ns;
+	int ticks = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	stats.ticks++;
+	if (timer_kind == INTERRUPT_TIMER_POSIX && sip->si_code == SI_TIMER) {
+		/* Expirations that happened while this signal was pending. This
+		 * is what timer_getoverrun() returns, without the system call.
+		 */
+		stats.overruns += sip->si_overrun;
+		ticks += sip->si_overrun;
+	}
+	if (last_tick.tv_sec != 0 || last_tick.tv_nsec != 0) {
+		diff = timespec_sub(&now, &last_tick);
+		ns = diff.tv_sec * NSEC_PER_SEC + diff.tv_nsec;
+		stats.intervals++;
+		if (stats.intervals == 1 || ns < stats.interval_min_ns)
+			stats.interval_min_ns = ns;
+		if (ns > stats.interval_max_ns)
+			stats.interval_max_ns = ns;
+		stats.interval_sum_ns += ns;
+		stats.interval_sumsq += (double)ns * ns;
+	}
+	last_tick = now;
+	return ticks;
+}
+
+static void
+start_timer()
+{
+	int ret;
+	struct sigevent sev;
+	struct itimerspec val;
+
+	armed = true;
+	if (timer_kind == INTERRUPT_TIMER_ITIMER) {
+		/* one timer for the whole process */
+		assert(!use_lock);
+		set_interrupt();
+		return;
+	}
+
+	/* A periodic timer on the monotonic clock: no re-arming from the
+	 * handler, and the period does not drift by the handler's latency.
+	 * It signals the kernel thread that started it.
+	 */
+	if (!posix_timer_created) {
+		memset(&sev, 0, sizeof(sev));
+		sev.sigev_notify = SIGEV_THREAD_ID;
+		sev.sigev_signo = SIG_TYPE;
+		sev.sigev_notify_thread_id = gettid();
+		ret = timer_create(CLOCK_MONOTONIC, &sev, &posix_timer);
+		assert(!ret);
+		posix_timer_created = true;
+	}
+
+	val.it_value.tv_sec = 0;
+	val.it_value.tv_nsec = SIG_INTERVAL * 1000;
+	val.it_interval = val.it_value;
+	ret = timer_settime(posix_timer, 0, &val, NULL);
+	assert(!ret);
+}
+
+static void
+disarm_timer()
+{
+	int ret;
+
+	armed = false;
+	clock_gettime(CLOCK_MONOTONIC, &disarmed_at);
+	if (timer_kind == INTERRUPT_TIMER_ITIMER) {
+		struct itimerval val = { { 0, 0 }, { 0, 0 } };
+		ret = setitimer(ITIMER_REAL, &val, NULL);
+	} else {
+		struct itimerspec val = { { 0, 0 }, { 0, 0 } };
+		ret = timer_settime(posix_timer, 0, &val, NULL);
+	}
+	assert(!ret);
+}
+
+static long
+ticks_avoided_since(const struct timespec *now)
+{
+	struct timespec diff;
+
+	if (disarmed_at.tv_sec == 0 && disarmed_at.tv_nsec == 0) {
+		/* never started on this kernel thread */
+		return 0;
+	}
+	diff = timespec_sub(now, &disarmed_at);
+	return (diff.tv_sec * NSEC_PER_SEC + diff.tv_nsec) / (SIG_INTERVAL * 1000L);
 }
 
 /*
@@ -227,6 +507,10 @@ set_interrupt()
 	int ret;
 	struct itimerval val;
 
+	if (timer_kind != INTERRUPT_TIMER_ITIMER || !armed) {
+		return;
+	}
+
 	/* QUESTION: Will the timer automatically fire every SIG_INTERVAL
 	 * microseconds or not? (HINT: Read the man page for setitimer.)
 	 */
@@ -2,6 +2,7 @@
 #define _INTERRUPT_H_
 
 //#include <stdio.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 
@@ -10,7 +11,32 @@
 /* the interrupt will be delivered every 200 usec */
 #define SIG_INTERVAL 200
 
+/* Timers that can deliver the interrupts. */
+enum interrupt_timer {
+	/* periodic timer_create() timer on CLOCK_MONOTONIC (default) */
+	INTERRUPT_TIMER_POSIX,
+	/* one-shot setitimer(ITIMER_REAL), re-armed on every interrupt */
+	INTERRUPT_TIMER_ITIMER,
+};
+
+struct interrupt_stats {
+	long ticks;		/* timer signals received */
+	long overruns;		/* expirations lost while a signal was pending */
+	long deferred;		/* signals that arrived with interrupts off */
+	long ticks_avoided;	/* ticks skipped while the timer was stopped */
+	long intervals;		/* intervals measured between two ticks */
+	long interval_min_ns;	/* shortest time between two signals */
+	long interval_max_ns;	/* longest time between two signals */
+	long interval_sum_ns;	/* sum of the intervals */
+	double interval_sumsq;	/* sum of the squared intervals, in ns^2 */
+};
+
 void register_interrupt_handler(bool verbose);
+void interrupts_use_timer(enum interrupt_timer timer);
+void interrupts_get_stats(struct interrupt_stats *stats);
+void interrupts_arm();
+void interrupts_use_lock();
+void interrupts_kick(pthread_t thread);
 bool interrupts_on(void);
 bool interrupts_off(void);
 bool interrupts_set(bool enable);
@@ -1,9 +1,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <assert.h>
 #include "khash.h"
 #include "interrupt.h"
+#include "malloc369.h"
 
 /* Need 2^63 bytes malloced before these will overflow as 
  * signed types, and having signs makes the math safer
@@ -15,6 +17,12 @@ long bytes_malloced; /* Total number of bytes malloced */
 long bytes_freed;    /* Total number of bytes freed */
 
 static bool verbose;
+/* Fast mode: no map, no poisoning. The size lives in a header in front of
+ * each block instead, so the counters stay exact. */
+static bool fast;
+
+/* Keeps the memory after the header aligned like malloc's. */
+#define HEADER_SIZE 16
 
 /* Add some status bits to the 'size' stored in the malloc map */
 #define FREED   0x8000000000000000 /* if set, ptr has been freed already */
@@ -22,11 +30,20 @@ static bool verbose;
 KHASH_MAP_INIT_INT64(ptrmap, size_t)
 khash_t(ptrmap) *malloc_map;
 		
-extern void * malloc369(size_t size)
+static void * tracked_malloc(size_t size)
 {
 	num_mallocs++;
 	bytes_malloced += size;
 
+	if (fast) {
+		size_t *header = malloc(HEADER_SIZE + size);
+		if (header == NULL) {
+			exit(-1);
+		}
+		*header = size;
+		return (char *)header + HEADER_SIZE;
+	}
+
 	void * m = malloc(size);
 	if (m == NULL) {
 		exit(-1);
@@ -44,7 +61,7 @@ extern void * malloc369(size_t size)
 	return m;
 }
 
-extern void free369(void * ptr)
+static void tracked_free(void * ptr)
 {
         size_t size = 0;
 	bool is_missing = true;
@@ -58,6 +75,16 @@ extern void free369(void * ptr)
 		return;
 	}
 
+	if (fast) {
+		size_t *header = (size_t *)((char *)ptr - HEADER_SIZE);
+		assert(num_mallocs - num_frees > 0);
+		num_frees++;
+		assert((bytes_malloced - bytes_freed) >= *header);
+		bytes_freed += *header;
+		free(header);
+		return;
+	}
+
 	k = kh_get(ptrmap, malloc_map, (size_t)ptr);
 	is_missing = (k == kh_end(malloc_map));
 	
@@ -112,21 +139,44 @@ extern void free369(void * ptr)
 	 *
 	 * Looking at memory in hex, or as (void *) type in gdb will make it
 	 * easy to spot the 'freed memory chunk' pattern. 
+	 *
+	 * memset fills many bytes per instruction, even in -O0 builds.
 	 */
-
-	char *region = (char *)ptr;
-	for (size_t i = 0; i < size; i++) {
-		region[i] = 0xee;
-	}
+	memset(ptr, 0xee, size);
 	free(ptr);
 	kh_value(malloc_map, k) |= FREED;
 	
 }
 
+/* Interrupts are off while the counters and the map are updated. With
+ * thread_options.workers, that also keeps out the other kernel threads. */
+extern void * malloc369(size_t size)
+{
+	bool enabled = interrupts_off();
+	void * m = tracked_malloc(size);
+	interrupts_set(enabled);
+	return m;
+}
+
+extern void free369(void * ptr)
+{
+	bool enabled = interrupts_off();
+	tracked_free(ptr);
+	interrupts_set(enabled);
+}
+
 
 extern void init_csc369_malloc(bool verb)
 {
-        malloc_map = kh_init(ptrmap);
+	init_csc369_malloc_mode(verb, false);
+}
+
+extern void init_csc369_malloc_mode(bool verb, bool fast_mode)
+{
+	fast = fast_mode;
+	if (!fast) {
+		malloc_map = kh_init(ptrmap);
+	}
 	verbose = verb;
 	num_mallocs = 0;
 	bytes_malloced = 0;
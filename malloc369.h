@@ -13,5 +13,8 @@ extern bool is_leak_free();
 extern void *malloc369(size_t size);
 extern void free369(void *ptr);
 extern void init_csc369_malloc(bool verbose);
+/* With fast set, freed memory is not poisoned and frees of pointers that did
+ * not come from malloc369 are not caught, but the counts stay exact. */
+extern void init_csc369_malloc_mode(bool verbose, bool fast);
 
 #endif /* _MALLOC369_H__ */
@@ -0,0 +1,214 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "thread.h"
+#include "malloc369.h"
+#include "stack.h"
+
+/* A free stack in the pool. The link is kept at the bottom of the stack, the
+ * end a thread reaches last, so the warm top stays as the last thread left
+ * it. */
+struct free_stack {
+	struct free_stack *next;
+};
+
+static struct free_stack *pool[STACK_CLASSES];
+static int pool_count[STACK_CLASSES];
+static int pool_max;
+static struct stack_stats stats;
+static bool mmap_stacks;
+
+static size_t
+page_size()
+{
+	static size_t size;
+
+	if (size == 0) {
+		size = sysconf(_SC_PAGESIZE);
+	}
+	return size;
+}
+
+/* Gets a new stack from malloc369 or mmap. */
+static void *
+stack_new(size_t size)
+{
+	char *base;
+
+	if (!mmap_stacks) {
+		return malloc369(size);
+	}
+	base = mmap(NULL, size + page_size(), PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+		    -1, 0);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+	if (mprotect(base, page_size(), PROT_NONE) != 0) {
+		munmap(base, size + page_size());
+		return NULL;
+	}
+	return base + page_size();
+}
+
+static void
+stack_delete(void *stack, size_t size)
+{
+	if (!mmap_stacks) {
+		free369(stack);
+		return;
+	}
+	munmap((char *)stack - page_size(), size + page_size());
+}
+
+/* Returns the class that fits size, or -1 if size is too big to pool. */
+static int
+stack_class(size_t size)
+{
+	int class = 0;
+
+	while (((size_t)THREAD_MIN_ATTR_STACK << class) < size) {
+		if (++class == STACK_CLASSES) {
+			return -1;
+		}
+	}
+	return class;
+}
+
+static void
+pool_trim(int class, int max)
+{
+	while (pool_count[class] > max) {
+		struct free_stack *stack = pool[class];
+
+		pool[class] = stack->next;
+		pool_count[class]--;
+		stats.pooled--;
+		stats.pooled_bytes -= (long)THREAD_MIN_ATTR_STACK << class;
+		stack_delete(stack, (size_t)THREAD_MIN_ATTR_STACK << class);
+	}
+}
+
+void
+stack_use_mmap(bool use_mmap)
+{
+	assert(stats.allocs == 0);
+	mmap_stacks = use_mmap;
+}
+
+void
+stack_pool_set_max(int max_per_class)
+{
+	int class;
+
+	assert(max_per_class >= 0);
+	pool_max = max_per_class;
+	for (class = 0; class < STACK_CLASSES; class++) {
+		pool_trim(class, pool_max);
+	}
+}
+
+void *
+stack_alloc(size_t *size)
+{
+	int class = stack_class(*size);
+	struct free_stack *stack;
+
+	stats.allocs++;
+	if (class < 0) {
+		if (mmap_stacks) {
+			*size = (*size + page_size() - 1) & ~(page_size() - 1);
+		}
+		return stack_new(*size);
+	}
+	*size = (size_t)THREAD_MIN_ATTR_STACK << class;
+	stack = pool[class];
+	if (stack == NULL) {
+		return stack_new(*size);
+	}
+	pool[class] = stack->next;
+	pool_count[class]--;
+	stats.reused++;
+	stats.pooled--;
+	stats.pooled_bytes -= *size;
+	return stack;
+}
+
+void
+stack_free(void *stack, size_t size)
+{
+	int class = stack_class(size);
+	struct free_stack *free_stack = stack;
+
+	if (class < 0 || pool_count[class] >= pool_max) {
+		stack_delete(stack, size);
+		return;
+	}
+	assert(size == (size_t)THREAD_MIN_ATTR_STACK << class);
+	free_stack->next = pool[class];
+	pool[class] = free_stack;
+	pool_count[class]++;
+	stats.pooled++;
+	stats.pooled_bytes += size;
+}
+
+void
+stack_get_stats(struct stack_stats *out)
+{
+	*out = stats;
+}
+
+size_t
+stack_guard_size(void)
+{
+	return mmap_stacks ? page_size() : 0;
+}
+
+long
+stack_committed(void *stack, size_t size)
+{
+	static unsigned char vec[4096];
+	uintptr_t start = (uintptr_t)stack & ~(page_size() - 1);
+	uintptr_t end = (uintptr_t)stack + size;
+	long committed = 0;
+
+	while (start < end) {
+		size_t len = end - start;
+		size_t npages, ii;
+
+		if (len > sizeof(vec) * page_size()) {
+			len = sizeof(vec) * page_size();
+		}
+		npages = (len + page_size() - 1) / page_size();
+		if (mincore((void *)start, len, vec) != 0) {
+			break;
+		}
+		for (ii = 0; ii < npages; ii++) {
+			committed += (vec[ii] & 1) * page_size();
+		}
+		start += npages * page_size();
+	}
+	return committed;
+}
+
+long
+stack_reclaim(void *stack, size_t size, void *sp)
+{
+	uintptr_t start = ((uintptr_t)stack + page_size() - 1) &
+			  ~(page_size() - 1);
+	uintptr_t end = (uintptr_t)sp & ~(page_size() - 1);
+	long committed;
+
+	assert((char *)sp > (char *)stack && (char *)sp <= (char *)stack + size);
+	if (end <= start) {
+		return 0;
+	}
+	committed = stack_committed((void *)start, end - start);
+	if (committed == 0 ||
+	    madvise((void *)start, end - start, MADV_DONTNEED) != 0) {
+		return 0;
+	}
+	return committed;
+}
@@ -0,0 +1,52 @@
+#ifndef _STACK_H_
+#define _STACK_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Thread stacks come in size classes: THREAD_MIN_ATTR_STACK, twice that, and
+ * so on up to STACK_MAX_POOLED. Up to a high-water mark per class, the stacks of
+ * dead threads are kept for the next threads of the same class instead of
+ * being freed. Bigger stacks are never kept. */
+#define STACK_CLASSES 12
+#define STACK_MAX_POOLED (THREAD_MIN_ATTR_STACK << (STACK_CLASSES - 1))
+
+/* Stacks come from malloc369 unless stack_use_mmap(true) is called before the
+ * first one is allocated. mmap stacks are reserved without being committed,
+ * so a page only takes memory once a thread touches it, and an inaccessible
+ * guard page below each stack makes an overflow fault instead of silently
+ * corrupting whatever is below it. */
+void stack_use_mmap(bool use_mmap);
+
+struct stack_stats {
+	long allocs;	/* stacks handed out */
+	long reused;	/* of those, stacks taken from the pool */
+	long pooled;	/* stacks in the pool right now */
+	long pooled_bytes; /* bytes in the pool right now */
+};
+
+/* Keep up to max_per_class stacks of each class. 0, the default, turns the
+ * pool off. Lowering the mark frees the stacks above it. */
+void stack_pool_set_max(int max_per_class);
+
+/* Returns a stack of at least *size bytes, and sets *size to its real size.
+ * Returns NULL if there is no memory for it. */
+void *stack_alloc(size_t *size);
+
+/* Gives back a stack returned by stack_alloc, with the size it set. */
+void stack_free(void *stack, size_t size);
+
+void stack_get_stats(struct stack_stats *stats);
+
+/* Bytes of address space below each stack taken by its guard page. */
+size_t stack_guard_size(void);
+
+/* Bytes of the stack that are backed by memory right now. */
+long stack_committed(void *stack, size_t size);
+
+/* Gives back the pages of the stack that lie wholly below sp, the saved stack
+ * pointer of a thread that is switched out. They read as zero when they are
+ * touched again. Returns how many bytes were backed by memory. */
+long stack_reclaim(void *stack, size_t size, void *sp);
+
+#endif /* _STACK_H_ */
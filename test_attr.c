@@ -0,0 +1,127 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Checks thread_create_attr: small stacks, stacks given by the caller, names,
+ * and settings that are out of range.
+ *****************************************************************************/
+
+static char caller_stack[64 * 1024];
+static char *where;
+
+static void
+test_attr_thread(void *arg)
+{
+	char here;
+
+	where = &here;
+	assert(strcmp(thread_name(THREAD_SELF), arg) == 0);
+}
+
+static void
+run(const struct thread_attr *attr, const char *name)
+{
+	Tid ret;
+
+	ret = thread_create_attr(attr, test_attr_thread, (void *)name);
+	assert(thread_ret_ok(ret));
+	assert(strcmp(thread_name(ret), name) == 0);
+	ret = thread_wait(ret, NULL);
+	assert(thread_ret_ok(ret));
+	assert(thread_name(ret) == NULL);
+}
+
+static void
+test_attr()
+{
+	struct thread_attr attr;
+	struct thread_stack_usage usage;
+	long mallocs;
+	Tid ret;
+
+	unintr_printf("starting attr test\n");
+	assert(thread_name(THREAD_SELF) == NULL);
+
+	/* a small stack */
+	thread_attr_init(&attr);
+	attr.stack_size = THREAD_MIN_ATTR_STACK;
+	attr.name = "small";
+	attr.priority = THREAD_PRIO_LOWEST;
+	ret = thread_create_attr(&attr, test_attr_thread, "small");
+	assert(thread_ret_ok(ret));
+	thread_stack_usage(&usage);
+	assert(usage.stacks == 1);
+	assert(usage.reserved == THREAD_MIN_ATTR_STACK);
+	assert(thread_wait(ret, NULL) == ret);
+
+	/* the caller's stack is used, and not freed */
+	thread_attr_init(&attr);
+	attr.stack = caller_stack;
+	attr.stack_size = sizeof(caller_stack);
+	attr.name = "caller stack";
+	attr.quantum_usecs = 2 * SIG_INTERVAL;
+	mallocs = get_num_mallocs();
+	run(&attr, "caller stack");
+	assert(where > caller_stack &&
+	       where < caller_stack + sizeof(caller_stack));
+	assert(get_num_mallocs() == mallocs);
+
+	/* long names are cut */
+	thread_attr_init(&attr);
+	attr.name = "a name that is much too long";
+	ret = thread_create_attr(&attr, test_attr_thread, NULL);
+	assert(thread_ret_ok(ret));
+	assert(strlen(thread_name(ret)) == THREAD_NAME_MAX - 1);
+	assert(strncmp(thread_name(ret), attr.name, THREAD_NAME_MAX - 1) == 0);
+	assert(thread_kill(ret) == ret);
+
+	/* settings out of range */
+	thread_attr_init(&attr);
+	attr.stack_size = THREAD_MIN_ATTR_STACK - 1;
+	assert(thread_create_attr(&attr, test_attr_thread, NULL)
+	       == THREAD_INVALID);
+	thread_attr_init(&attr);
+	attr.stack = caller_stack;
+	assert(thread_create_attr(&attr, test_attr_thread, NULL)
+	       == THREAD_INVALID);
+	thread_attr_init(&attr);
+	attr.priority = THREAD_PRIO_HIGHEST - 1;
+	assert(thread_create_attr(&attr, test_attr_thread, NULL)
+	       == THREAD_INVALID);
+	thread_attr_init(&attr);
+	attr.quantum_usecs = -1;
+	assert(thread_create_attr(&attr, test_attr_thread, NULL)
+	       == THREAD_INVALID);
+
+	/* no attr at all */
+	ret = thread_create_attr(NULL, test_attr_thread, NULL);
+	assert(thread_ret_ok(ret));
+	assert(thread_name(ret) == NULL);
+	assert(thread_kill(ret) == ret);
+
+	if (!is_leak_free(0, 0)) {
+		unintr_printf("test_attr: error, %ld bytes leaked\n",
+			      get_current_bytes_malloced());
+		assert(0);
+	}
+	unintr_printf("attr test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	/* Cooperative only: the test checks threads before they get to run. */
+
+	test_attr();
+	return 0;
+}
@@ -0,0 +1,161 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Checks copy-stack mode, where threads share one run stack and their frames
+ * are copied out and back in around switches. Threads fill their frames with
+ * a pattern and check it after every switch: cooperatively, mixed with a
+ * thread that has its own stack, and under timer preemption. Parked threads
+ * must only keep a small buffer each.
+ *****************************************************************************/
+
+#define NCHILD 64
+#define YIELDS 100
+#define FRAME 512
+#define PARKED_MAX 2048 /* bytes of saved frames a parked thread may keep */
+
+static struct wait_queue *queue;
+static volatile int running;
+
+static void
+check(volatile long *frame, long tid)
+{
+	int ii;
+
+	for (ii = 0; ii < FRAME; ii++) {
+		if (frame[ii] != tid * FRAME + ii) {
+			unintr_printf("test_copy_stack: error, thread %ld found "
+				      "%ld at %d\n", tid, frame[ii], ii);
+			assert(0);
+		}
+	}
+}
+
+static void
+yielding_thread(void *arg)
+{
+	volatile long frame[FRAME];
+	long tid = thread_id();
+	int ii;
+
+	for (ii = 0; ii < FRAME; ii++) {
+		frame[ii] = tid * FRAME + ii;
+	}
+	for (ii = 0; ii < YIELDS; ii++) {
+		thread_yield(THREAD_ANY);
+		check(frame, tid);
+	}
+	thread_exit((int)tid);
+}
+
+static void
+spinning_thread(void *arg)
+{
+	volatile long frame[FRAME];
+	long tid = thread_id();
+	int ii;
+
+	for (ii = 0; ii < FRAME; ii++) {
+		frame[ii] = tid * FRAME + ii;
+	}
+	__sync_fetch_and_add(&running, 1);
+	while (__sync_fetch_and_add(&running, 0) > 0) {
+		check(frame, tid);
+	}
+}
+
+static void
+parked_thread(void *arg)
+{
+	thread_sleep(queue);
+}
+
+static void
+run_all(void (*fn)(void *), bool own_stack)
+{
+	struct thread_attr attr;
+	Tid child[NCHILD];
+	int ii, exit_code;
+
+	for (ii = 0; ii < NCHILD; ii++) {
+		thread_attr_init(&attr);
+		if (own_stack && ii % 2 == 0) {
+			attr.stack_size = THREAD_MIN_STACK;
+		}
+		child[ii] = thread_create_attr(&attr, fn, NULL);
+		assert(thread_ret_ok(child[ii]));
+	}
+	for (ii = 0; ii < NCHILD; ii++) {
+		assert(thread_wait(child[ii], &exit_code) == child[ii]);
+	}
+}
+
+static void
+test_copy_stack()
+{
+	struct thread_stack_usage usage;
+	int ii;
+
+	unintr_printf("starting copy stack test\n");
+	queue = wait_queue_create();
+
+	run_all(yielding_thread, false);
+	run_all(yielding_thread, true);
+
+	for (ii = 0; ii < NCHILD; ii++) {
+		assert(thread_ret_ok(thread_create(parked_thread, NULL)));
+	}
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	thread_stack_usage(&usage);
+	assert(usage.stacks == NCHILD);
+	unintr_printf("parked threads keep %ld bytes each\n",
+		      usage.committed / NCHILD);
+	assert(usage.committed <= NCHILD * PARKED_MAX);
+	assert(thread_wakeup(queue, 1) == NCHILD);
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	thread_stack_usage(&usage);
+	assert(usage.stacks == 0);
+
+	register_interrupt_handler(false);
+	for (ii = 0; ii < 4; ii++) {
+		assert(thread_ret_ok(thread_create(spinning_thread, NULL)));
+	}
+	while (__sync_fetch_and_add(&running, 0) < 4) {
+		thread_yield(THREAD_ANY);
+	}
+	spin(200000);
+	running = 0;
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+
+	wait_queue_destroy(queue);
+	if (!is_leak_free(0, 0)) {
+		unintr_printf("test_copy_stack: error, %ld bytes leaked\n",
+			      get_current_bytes_malloced());
+		assert(0);
+	}
+	unintr_printf("copy stack test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_options options = { 0 };
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library, in copy-stack mode */
+	options.stack_shared = 1;
+	options.stack_size = 256 * 1024;
+	thread_init_options(&options);
+
+	test_copy_stack();
+	return 0;
+}
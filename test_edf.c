@@ -0,0 +1,170 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Checks earliest-deadline-first scheduling. Ready threads with a deadline
+ * run before the others, earliest first, and meeting or missing their
+ * deadlines is counted. A thread woken with a deadline runs right away, and
+ * one that gets a deadline while busy threads are ready runs at the next
+ * tick. A thread with a deadline that runs alone lets the timer stop.
+ *****************************************************************************/
+
+#define MS 1000000L
+#define NHOG 4
+#define MAX_LATENCY_NS (3 * SIG_INTERVAL * 1000L) /* FIFO waits NHOG slices */
+#define ALONE_USECS 100000
+#define MAX_ALONE_TICKS 10 /* of the 500 the timer would send */
+
+static int order[8];
+static int norder;
+static volatile int stop;
+static volatile long ran_at;
+static struct wait_queue *queue;
+
+static void
+test_order_thread(void *arg)
+{
+	order[norder++] = (long)arg;
+}
+
+static void
+test_hog_thread(void *arg)
+{
+	while (!stop)
+		;
+}
+
+static void
+test_responder_thread(void *arg)
+{
+	thread_sleep(queue);
+	ran_at = now_ns();
+}
+
+static Tid
+create_deadline(long num, long deadline)
+{
+	Tid ret = thread_create(test_order_thread, (void *)num);
+
+	assert(thread_ret_ok(ret));
+	if (deadline != 0) {
+		assert(thread_set_deadline(ret, deadline) == ret);
+	}
+	return ret;
+}
+
+static void
+test_edf()
+{
+	struct thread_deadline_stats stats;
+	struct interrupt_stats istats;
+	Tid hog[NHOG];
+	Tid ret, responder;
+	long now, latency, ticks;
+	int ii;
+
+	unintr_printf("starting edf test\n");
+
+	ret = thread_set_deadline(THREAD_SELF, -1);
+	assert(ret == THREAD_INVALID);
+	ret = thread_set_deadline(THREAD_MAX_THREADS - 1, now_ns());
+	assert(ret == THREAD_INVALID);
+
+	/* earliest deadline first, then the others in the usual order */
+	now = now_ns();
+	create_deadline(0, 0);
+	create_deadline(1, now + 3 * MS);
+	create_deadline(2, now + 1 * MS);
+	create_deadline(3, now + 2 * MS);
+	thread_yield(THREAD_ANY);
+	assert(norder == 4);
+	assert(order[0] == 2 && order[1] == 3 && order[2] == 1 &&
+	       order[3] == 0);
+	thread_deadline_stats(&stats);
+	assert(stats.met == 3 && stats.missed == 0);
+
+	/* already late */
+	create_deadline(4, now_ns() - 1);
+	thread_yield(THREAD_ANY);
+	thread_deadline_stats(&stats);
+	assert(stats.met == 3 && stats.missed == 1 && stats.max_late_ns > 0);
+
+	/* woken with a deadline: runs before we return */
+	queue = wait_queue_create();
+	responder = thread_create(test_responder_thread, NULL);
+	assert(thread_ret_ok(responder));
+	thread_yield(responder);
+	ran_at = 0;
+	ret = thread_wakeup_deadline(queue, 0, now_ns() + 10 * MS);
+	assert(ret == 1);
+	assert(ran_at != 0);
+	thread_deadline_stats(&stats);
+	assert(stats.met == 4);
+
+	/* a deadline ahead of busy threads: runs at the next tick */
+	register_interrupt_handler(false);
+	for (ii = 0; ii < NHOG; ii++) {
+		hog[ii] = thread_create(test_hog_thread, NULL);
+		assert(thread_ret_ok(hog[ii]));
+	}
+	responder = thread_create(test_responder_thread, NULL);
+	assert(thread_ret_ok(responder));
+	while (thread_wakeup(queue, 0) == 0) {
+		thread_yield(responder);
+	}
+	ran_at = 0;
+	now = now_ns();
+	ret = thread_set_deadline(responder, now + 10 * MS);
+	assert(ret == responder);
+	while (ran_at == 0)
+		;
+	latency = ran_at - now;
+	stop = 1;
+	for (ii = 0; ii < NHOG; ii++) {
+		ret = thread_wait(hog[ii], NULL);
+		assert(ret == hog[ii]);
+	}
+	wait_queue_destroy(queue);
+	unintr_printf("ran %ld us after getting a deadline\n", latency / 1000);
+	if (latency > MAX_LATENCY_NS) {
+		unintr_printf("test_edf: error, waited behind busy threads\n");
+		assert(0);
+	}
+	thread_deadline_stats(&stats);
+	assert(stats.met == 5 && stats.missed == 1);
+
+	/* alone with a deadline: nothing to preempt */
+	ret = thread_set_deadline(THREAD_SELF, now_ns() + 1000 * MS);
+	assert(ret == thread_id());
+	interrupts_get_stats(&istats);
+	ticks = istats.ticks;
+	spin(ALONE_USECS);
+	interrupts_get_stats(&istats);
+	ticks = istats.ticks - ticks;
+	unintr_printf("%ld ticks while alone with a deadline\n", ticks);
+	if (ticks > MAX_ALONE_TICKS) {
+		unintr_printf("test_edf: error, the timer kept going\n");
+		assert(0);
+	}
+	assert(thread_set_deadline(THREAD_SELF, 0) == thread_id());
+	thread_deadline_stats(&stats);
+	assert(stats.met == 6);
+	unintr_printf("edf test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	test_edf();
+	return 0;
+}
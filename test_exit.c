@@ -0,0 +1,93 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Checks how exited threads are freed. The stack of an exiting thread is
+ * freed by the next thread to run, so it is gone as soon as thread_yield
+ * returns to us. The main thread does not have to stay around for this: once
+ * it exits, the remaining threads keep exiting, and the last one ends the
+ * process.
+ *****************************************************************************/
+
+#define NCHILD 8
+
+static int exited;
+static long start_mallocs;
+
+static void
+test_exit_thread(void *arg)
+{
+	exited++;
+}
+
+static void
+test_orphan_thread(void *arg)
+{
+	long num = (long)arg;
+
+	/* the main thread is gone, and we exit one after another */
+	assert(exited == num);
+	exited++;
+	if (num == NCHILD - 1) {
+		/* only our own stack is left */
+		assert(get_current_num_mallocs() == start_mallocs + 1);
+		unintr_printf("exit test done\n");
+	}
+	thread_exit(0);
+}
+
+static void
+test_exit()
+{
+	Tid ret;
+	long ii;
+
+	unintr_printf("starting exit test\n");
+	start_mallocs = get_current_num_mallocs();
+
+	/* one at a time: we free each stack as the thread switches back to us */
+	for (ii = 0; ii < NCHILD; ii++) {
+		ret = thread_create(test_exit_thread, NULL);
+		assert(thread_ret_ok(ret));
+		assert(thread_yield(ret) == ret);
+		assert(get_current_num_mallocs() == start_mallocs);
+	}
+
+	/* many at once */
+	exited = 0;
+	for (ii = 0; ii < NCHILD; ii++) {
+		ret = thread_create(test_exit_thread, NULL);
+		assert(thread_ret_ok(ret));
+	}
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	assert(exited == NCHILD);
+	assert(get_current_num_mallocs() == start_mallocs);
+
+	/* the main thread exits first */
+	exited = 0;
+	for (ii = 0; ii < NCHILD; ii++) {
+		ret = thread_create(test_orphan_thread, (void *)ii);
+		assert(thread_ret_ok(ret));
+	}
+	thread_exit(0);
+	assert(0);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	/* Cooperative only: the test checks the order threads exit in. */
+	test_exit();
+	return 0;
+}
@@ -0,0 +1,134 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Checks fair scheduling. Busy threads of different priorities share the CPU
+ * in proportion to their weights. A thread that sleeps does not build up credit that
+ * would let it keep the CPU to itself once it wakes up.
+ *****************************************************************************/
+
+#define DURATION 1000000 /* usecs each part runs for */
+#define NCHILD 3
+#define TOLERANCE 0.10
+
+/* weights 1024, 3121 and 335 */
+static const int prio[NCHILD] = { 0, -5, 5 };
+static const double share[NCHILD] = { 0.228, 0.697, 0.075 };
+
+static long deadline;
+static long work[NCHILD];
+static struct wait_queue *queue;
+
+static void
+test_busy_thread(void *arg)
+{
+	long num = (long)arg;
+
+	while (now_ns() < deadline) {
+		work[num]++;
+	}
+}
+
+/* Sleeps for the first half of the run, then is as busy as the waker. */
+static void
+test_sleeper_thread(void *arg)
+{
+	thread_sleep(queue);
+	test_busy_thread((void *)1);
+}
+
+static void
+test_waker_thread(void *arg)
+{
+	spin(DURATION / 2);
+	assert(thread_wakeup(queue, 0) == 1);
+	test_busy_thread((void *)0);
+}
+
+static void
+check_shares(const char *what, void (*fn)(void *))
+{
+	struct thread_attr attr;
+	Tid child[NCHILD];
+	long total = 0;
+	double got;
+	int ii;
+	Tid ret;
+
+	deadline = now_ns() + DURATION * 1000L;
+	for (ii = 0; ii < NCHILD; ii++) {
+		work[ii] = 0;
+		thread_attr_init(&attr);
+		attr.priority = prio[ii];
+		child[ii] = thread_create_attr(&attr, fn, (void *)(long)ii);
+		assert(thread_ret_ok(child[ii]));
+	}
+	for (ii = 0; ii < NCHILD; ii++) {
+		ret = thread_wait(child[ii], NULL);
+		assert(ret == child[ii]);
+		total += work[ii];
+	}
+	for (ii = 0; ii < NCHILD; ii++) {
+		got = (double)work[ii] / total;
+		unintr_printf("%s: priority %d got %.1f%%, wants %.1f%%\n",
+			      what, prio[ii], 100 * got, 100 * share[ii]);
+		if (got < share[ii] * (1 - TOLERANCE) ||
+		    got > share[ii] * (1 + TOLERANCE)) {
+			unintr_printf("test_fair: error, share is off\n");
+			assert(0);
+		}
+	}
+}
+
+static void
+test_fair()
+{
+	Tid sleeper, waker, ret;
+	double got;
+
+	unintr_printf("starting fair test\n");
+	register_interrupt_handler(false);
+	check_shares("busy", test_busy_thread);
+
+	/* The sleeper wakes up far behind the waker in CPU time, but that
+	 * must not buy it the CPU to itself: they split the second half. */
+	queue = wait_queue_create();
+	work[0] = work[1] = 0;
+	deadline = now_ns() + DURATION * 1000L;
+	sleeper = thread_create(test_sleeper_thread, NULL);
+	assert(thread_ret_ok(sleeper));
+	waker = thread_create(test_waker_thread, NULL);
+	assert(thread_ret_ok(waker));
+	ret = thread_wait(sleeper, NULL);
+	assert(ret == sleeper);
+	ret = thread_wait(waker, NULL);
+	assert(ret == waker);
+	wait_queue_destroy(queue);
+	got = (double)work[1] / (work[0] + work[1]);
+	unintr_printf("woken: got %.1f%%, wants 50.0%%\n", 100 * got);
+	if (got < 0.5 * (1 - TOLERANCE) || got > 0.5 * (1 + TOLERANCE)) {
+		unintr_printf("test_fair: error, share is off\n");
+		assert(0);
+	}
+	unintr_printf("fair test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_options options = { 0 };
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library, with fair scheduling */
+	options.scheduler = THREAD_SCHED_FAIR;
+	thread_init_options(&options);
+
+	test_fair();
+	return 0;
+}
@@ -0,0 +1,136 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Killed threads must leave whatever queue they were on right away, so that
+ * nothing stale is left behind for a thread that later reuses their tid.
+ *
+ * 1. Kill half of a group of sleepers. A wakeup of all must wake exactly the
+ *    other half.
+ * 2. A thread waiting in thread_wait() is killed, and its tid is reused by a
+ *    new thread that goes to sleep. When the waited-for thread exits, the new
+ *    thread must stay asleep, and another thread must be able to wait.
+ *****************************************************************************/
+
+#define NSLEEPERS 64
+
+static struct wait_queue *queue;
+static int woken;
+static int release;
+
+static void
+test_sleeper_thread(void *arg)
+{
+	thread_sleep(queue);
+	woken++;
+}
+
+static void
+test_exiting_thread(void *arg)
+{
+	while (!release) {
+		thread_yield(THREAD_ANY);
+	}
+	thread_exit(42);
+}
+
+static void
+test_waiting_thread(Tid tid)
+{
+	thread_wait(tid, NULL);
+	/* we are killed while waiting */
+	assert(0);
+}
+
+static void
+test_kill_sleepers()
+{
+	Tid child[NSLEEPERS];
+	Tid ret;
+	int ii;
+
+	for (ii = 0; ii < NSLEEPERS; ii++) {
+		child[ii] = thread_create(test_sleeper_thread, NULL);
+		assert(thread_ret_ok(child[ii]));
+	}
+	/* let them all go to sleep */
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	for (ii = 0; ii < NSLEEPERS; ii += 2) {
+		ret = thread_kill(child[ii]);
+		assert(ret == child[ii]);
+	}
+	ret = thread_wakeup(queue, 1);
+	if (ret != NSLEEPERS / 2) {
+		unintr_printf("test_kill_queued: error, woke %d sleepers, "
+			      "expected %d\n", ret, NSLEEPERS / 2);
+		assert(0);
+	}
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	assert(woken == NSLEEPERS / 2);
+}
+
+static void
+test_kill_waiter()
+{
+	Tid exiting, waiting, sleeper, ret;
+	int exit_code;
+
+	woken = 0;
+	exiting = thread_create(test_exiting_thread, NULL);
+	assert(thread_ret_ok(exiting));
+	waiting = thread_create((void (*)(void *))test_waiting_thread,
+				(void *)(long)exiting);
+	assert(thread_ret_ok(waiting));
+	ret = thread_yield(waiting);
+	assert(ret == waiting);
+
+	ret = thread_kill(waiting);
+	assert(ret == waiting);
+	sleeper = thread_create(test_sleeper_thread, NULL);
+	assert(sleeper == waiting);
+	ret = thread_yield(sleeper);
+	assert(ret == sleeper);
+
+	release = 1;
+	ret = thread_wait(exiting, &exit_code);
+	if (ret != exiting) {
+		unintr_printf("test_kill_queued: error, wait on thread %d "
+			      "returned %d\n", exiting, ret);
+		assert(0);
+	}
+	assert(exit_code == 42);
+	if (woken != 0) {
+		unintr_printf("test_kill_queued: error, thread %d was woken "
+			      "by the exit of thread %d\n", sleeper, exiting);
+		assert(0);
+	}
+	ret = thread_wakeup(queue, 1);
+	assert(ret == 1);
+	ret = thread_wait(sleeper, NULL);
+	assert(ret == sleeper);
+	assert(woken == 1);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	unintr_printf("starting kill queued test\n");
+	queue = wait_queue_create();
+	test_kill_sleepers();
+	test_kill_waiter();
+	wait_queue_destroy(queue);
+	unintr_printf("kill queued test done\n");
+	return 0;
+}
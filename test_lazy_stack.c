@@ -0,0 +1,95 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Checks lazy stacks. A created thread has no stack until it first runs, a
+ * thread killed before that never gets one, and a thread whose stack cannot
+ * be allocated when it is dispatched exits with THREAD_NOMEMORY.
+ *****************************************************************************/
+
+#define HUGE_STACK (1L << 50) /* more than the address space */
+
+static long ran;
+
+static void
+test_lazy_thread(void *arg)
+{
+	ran += (long)arg;
+}
+
+static int
+stacks()
+{
+	struct thread_stack_usage usage;
+
+	thread_stack_usage(&usage);
+	return usage.stacks;
+}
+
+static void
+test_lazy_stack()
+{
+	struct thread_attr attr;
+	Tid ret, huge;
+	int exit_code;
+
+	unintr_printf("starting lazy stack test\n");
+
+	/* killed before it ever runs */
+	ret = thread_create(test_lazy_thread, (void *)1);
+	assert(thread_ret_ok(ret));
+	assert(stacks() == 0);
+	assert(thread_kill(ret) == ret);
+	assert(stacks() == 0);
+
+	/* the stack appears when the thread first runs */
+	ret = thread_create(test_lazy_thread, (void *)2);
+	assert(thread_ret_ok(ret));
+	assert(stacks() == 0);
+	assert(thread_wait(ret, &exit_code) == ret);
+	assert(exit_code == 0);
+	assert(ran == 2);
+	assert(stacks() == 0);
+
+	/* no memory for the stack: thread_create cannot tell yet */
+	thread_attr_init(&attr);
+	attr.stack_size = HUGE_STACK;
+	huge = thread_create_attr(&attr, test_lazy_thread, (void *)4);
+	assert(thread_ret_ok(huge));
+	ret = thread_yield(huge);
+	assert(ret == THREAD_NOMEMORY);
+	assert(thread_wait(huge, &exit_code) == huge);
+	assert(exit_code == THREAD_NOMEMORY);
+
+	/* THREAD_ANY skips it and runs the next thread */
+	huge = thread_create_attr(&attr, test_lazy_thread, (void *)4);
+	assert(thread_ret_ok(huge));
+	ret = thread_create(test_lazy_thread, (void *)8);
+	assert(thread_ret_ok(ret));
+	assert(thread_yield(THREAD_ANY) == ret);
+	assert(thread_yield(THREAD_ANY) == THREAD_NONE);
+	assert(ran == 10);
+
+	unintr_printf("lazy stack test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_options options = { 0 };
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library, with lazy mmap stacks */
+	options.stack_lazy = 1;
+	options.stack_mmap = 1;
+	thread_init_options(&options);
+
+	test_lazy_stack();
+	return 0;
+}
@@ -0,0 +1,154 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Checks the MLFQ scheduler. Ready threads run in priority order, and
+ * thread_set_priority moves a thread to its new level. Then, with timer
+ * interrupts on, a thread that only runs briefly before yielding must not
+ * wait behind busy threads, which drop to lower levels as they use up their
+ * slices. A busy thread that drops a few levels but stays above every ready
+ * thread must keep the CPU.
+ *****************************************************************************/
+
+#define NHOG 4
+#define YIELDS 500
+#define MAX_WAIT_NS (3 * SIG_INTERVAL * 1000L) /* FIFO waits NHOG slices */
+
+static int order[8];
+static int norder;
+static volatile int stop;
+static volatile int low_ran;
+
+static void
+test_order_thread(void *arg)
+{
+	order[norder++] = (long)arg;
+}
+
+static void
+test_low_thread(void *arg)
+{
+	low_ran = 1;
+}
+
+/* Uses up 4 slices, which takes it from level 0 to 4, still above 7. */
+static void
+test_demoted_thread(void *arg)
+{
+	spin(4 * SIG_INTERVAL + SIG_INTERVAL / 2);
+	if (low_ran) {
+		unintr_printf("test_mlfq: error, a worse level ran at the end "
+			      "of our slice\n");
+		assert(0);
+	}
+}
+
+static void
+test_hog_thread(void *arg)
+{
+	while (!stop)
+		;
+}
+
+static Tid
+create_prio(int priority, long num)
+{
+	struct thread_attr attr;
+	Tid ret;
+
+	thread_attr_init(&attr);
+	attr.priority = priority;
+	ret = thread_create_attr(&attr, test_order_thread, (void *)num);
+	assert(thread_ret_ok(ret));
+	return ret;
+}
+
+static void
+test_mlfq()
+{
+	struct thread_attr attr;
+	Tid hog[NHOG];
+	Tid ret, low;
+	long start, wait, total = 0;
+	int ii;
+
+	unintr_printf("starting mlfq test\n");
+
+	ret = thread_set_priority(THREAD_SELF, THREAD_PRIO_LOWEST + 1);
+	assert(ret == THREAD_INVALID);
+	ret = thread_set_priority(THREAD_MAX_THREADS - 1, THREAD_PRIO_DEFAULT);
+	assert(ret == THREAD_INVALID);
+
+	/* higher priorities first, and we are at THREAD_PRIO_DEFAULT */
+	low = create_prio(THREAD_PRIO_LOWEST, 0);
+	create_prio(THREAD_PRIO_DEFAULT, 1);
+	create_prio(THREAD_PRIO_HIGHEST, 2);
+	create_prio(THREAD_PRIO_LOWEST, 3);
+	ret = thread_set_priority(low, THREAD_PRIO_HIGHEST);
+	assert(ret == low);
+	thread_yield(THREAD_ANY);
+	/* 0 moved up behind 2, and 1 was queued before we yielded */
+	assert(norder == 3);
+	assert(order[0] == 2 && order[1] == 0 && order[2] == 1);
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	assert(norder == 4 && order[3] == 3);
+
+	/* busy threads sink below us */
+	register_interrupt_handler(false);
+	for (ii = 0; ii < NHOG; ii++) {
+		hog[ii] = thread_create(test_hog_thread, NULL);
+		assert(thread_ret_ok(hog[ii]));
+	}
+	for (ii = 0; ii < YIELDS; ii++) {
+		start = now_ns();
+		ret = thread_yield(THREAD_ANY);
+		assert(thread_ret_ok(ret));
+		wait = now_ns() - start;
+		total += wait;
+	}
+	stop = 1;
+	for (ii = 0; ii < NHOG; ii++) {
+		ret = thread_wait(hog[ii], NULL);
+		assert(ret == hog[ii]);
+	}
+	unintr_printf("yield waited %ld us on average\n",
+		      total / YIELDS / 1000);
+	if (total / YIELDS > MAX_WAIT_NS) {
+		unintr_printf("test_mlfq: error, waited behind busy threads\n");
+		assert(0);
+	}
+
+	/* a demoted thread above everyone ready keeps running */
+	thread_attr_init(&attr);
+	attr.priority = THREAD_PRIO_LOWEST;
+	low = thread_create_attr(&attr, test_low_thread, NULL);
+	assert(thread_ret_ok(low));
+	attr.priority = THREAD_PRIO_HIGHEST;
+	ret = thread_create_attr(&attr, test_demoted_thread, NULL);
+	assert(thread_ret_ok(ret));
+	assert(thread_wait(ret, NULL) == ret);
+	assert(thread_wait(low, NULL) == low);
+	assert(low_ran);
+	unintr_printf("mlfq test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_options options = { 0 };
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library, with the MLFQ scheduler */
+	options.scheduler = THREAD_SCHED_MLFQ;
+	thread_init_options(&options);
+
+	test_mlfq();
+	return 0;
+}
@@ -0,0 +1,123 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Checks static priority scheduling. Ready threads run in priority order,
+ * thread_set_priority moves a thread to its new level, and with timer
+ * interrupts on, a busy thread of high priority keeps the CPU from threads
+ * of lower priority for as long as it runs: it is not demoted. Priorities
+ * only one step apart must be kept apart just the same.
+ *****************************************************************************/
+
+#define DURATION 200000 /* usecs the busy thread runs for */
+
+static int order[8];
+static int norder;
+static volatile int low_ran;
+
+static void
+test_order_thread(void *arg)
+{
+	order[norder++] = (long)arg;
+}
+
+static void
+test_high_thread(void *arg)
+{
+	long deadline = now_ns() + DURATION * 1000L;
+
+	while (now_ns() < deadline)
+		;
+	assert(!low_ran);
+}
+
+static void
+test_low_thread(void *arg)
+{
+	low_ran = 1;
+}
+
+static Tid
+create_prio(int priority, void (*fn)(void *), long num)
+{
+	struct thread_attr attr;
+	Tid ret;
+
+	thread_attr_init(&attr);
+	attr.priority = priority;
+	ret = thread_create_attr(&attr, fn, (void *)num);
+	assert(thread_ret_ok(ret));
+	return ret;
+}
+
+/* A busy thread at priority high must run to the end before one at low. */
+static void
+test_starve(int high_prio, int low_prio)
+{
+	Tid ret, high, low;
+
+	low_ran = 0;
+	low = create_prio(low_prio, test_low_thread, 0);
+	high = create_prio(high_prio, test_high_thread, 0);
+	/* the next tick hands the CPU to high */
+	ret = thread_wait(high, NULL);
+	assert(ret == high);
+	ret = thread_wait(low, NULL);
+	assert(ret == low);
+	assert(low_ran);
+}
+
+static void
+test_prio()
+{
+	Tid ret;
+
+	unintr_printf("starting prio test\n");
+
+	/* higher priorities first, and we are at THREAD_PRIO_DEFAULT */
+	create_prio(THREAD_PRIO_LOWEST, test_order_thread, 0);
+	ret = create_prio(THREAD_PRIO_LOWEST, test_order_thread, 1);
+	create_prio(THREAD_PRIO_HIGHEST, test_order_thread, 2);
+	ret = thread_set_priority(ret, THREAD_PRIO_DEFAULT);
+	assert(thread_ret_ok(ret));
+	thread_yield(THREAD_ANY);
+	assert(norder == 2 && order[0] == 2 && order[1] == 1);
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	assert(norder == 3 && order[2] == 0);
+
+	/* adjacent priorities, created worst first */
+	norder = 0;
+	create_prio(THREAD_PRIO_DEFAULT + 4, test_order_thread, 0);
+	create_prio(THREAD_PRIO_DEFAULT + 2, test_order_thread, 1);
+	create_prio(THREAD_PRIO_DEFAULT + 1, test_order_thread, 2);
+	while (thread_yield(THREAD_ANY) != THREAD_NONE)
+		;
+	assert(norder == 3);
+	assert(order[0] == 2 && order[1] == 1 && order[2] == 0);
+
+	register_interrupt_handler(false);
+	test_starve(THREAD_PRIO_HIGHEST, THREAD_PRIO_LOWEST);
+	test_starve(THREAD_PRIO_DEFAULT, THREAD_PRIO_DEFAULT + 1);
+	unintr_printf("prio test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_options options = { 0 };
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library, with static priorities */
+	options.scheduler = THREAD_SCHED_PRIO;
+	thread_init_options(&options);
+
+	test_prio();
+	return 0;
+}
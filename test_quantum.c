@@ -0,0 +1,98 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Two busy threads run side by side under timer interrupts, one with a short
+ * time slice and one with a long one. Each thread measures how long it gets
+ * to run before it is preempted. The long-slice thread must run in much
+ * longer bursts.
+ *****************************************************************************/
+
+#define DURATION    1000000 /* how long each thread spins, in usecs */
+#define GAP_NS       100000 /* a jump this large in time means we were off CPU */
+#define SHORT_SLICE SIG_INTERVAL
+#define LONG_SLICE  (20 * SIG_INTERVAL)
+
+static long bursts[2];
+static long burst_ns[2];
+
+static void
+test_quantum_thread(long num)
+{
+	long start = now_ns();
+	long burst_start = start;
+	long last = start;
+	long t;
+
+	while ((t = now_ns()) - start < DURATION * 1000L) {
+		if (t - last > GAP_NS) {
+			/* we were preempted between last and t */
+			bursts[num]++;
+			burst_ns[num] += last - burst_start;
+			burst_start = t;
+		}
+		last = t;
+	}
+	thread_exit(0);
+}
+
+static void
+test_quantum()
+{
+	Tid child[2];
+	long avg[2];
+	Tid ret;
+	int ii;
+
+	unintr_printf("starting quantum test\n");
+
+	ret = thread_set_quantum(THREAD_MAX_THREADS - 1, SHORT_SLICE);
+	assert(ret == THREAD_INVALID);
+	ret = thread_set_quantum(THREAD_SELF, 0);
+	assert(ret == THREAD_INVALID);
+
+	for (ii = 0; ii < 2; ii++) {
+		child[ii] = thread_create((void (*)(void *))test_quantum_thread,
+					  (void *)(long)ii);
+		assert(thread_ret_ok(child[ii]));
+	}
+	ret = thread_set_quantum(child[0], SHORT_SLICE);
+	assert(ret == child[0]);
+	ret = thread_set_quantum(child[1], LONG_SLICE);
+	assert(ret == child[1]);
+
+	for (ii = 0; ii < 2; ii++) {
+		ret = thread_wait(child[ii], NULL);
+		assert(ret == child[ii]);
+		assert(bursts[ii] > 0);
+		avg[ii] = burst_ns[ii] / bursts[ii] / 1000;
+	}
+	unintr_printf("%d us slice: ran %ld times for %ld us on average\n",
+		      SHORT_SLICE, bursts[0], avg[0]);
+	unintr_printf("%d us slice: ran %ld times for %ld us on average\n",
+		      LONG_SLICE, bursts[1], avg[1]);
+	if (avg[1] < 5 * avg[0]) {
+		unintr_printf("test_quantum: error, long slices are not longer\n");
+		assert(0);
+	}
+	unintr_printf("quantum test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+	/* Register interrupt handler & start timer interrupts. */
+	register_interrupt_handler(false);
+
+	test_quantum();
+	return 0;
+}
@@ -0,0 +1,158 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Checks that the stacks of sleeping threads are reclaimed. A thread dirties
+ * a deep stack, returns from it and goes to sleep. Reclaiming must give back
+ * the dead pages, and the thread must find its live frames intact when it
+ * wakes up. This is done on demand, then by the periodic policy while
+ * another thread keeps the timer running, and then by the policy while the
+ * initial thread runs alone, with nothing else for the timer to preempt.
+ *****************************************************************************/
+
+#define STACK_SIZE (256 * 1024)
+#define DIRTY (128 * 1024)	/* stack a sleeper dirties before sleeping */
+#define KEEP (16 * 1024)	/* stack that may stay committed per sleeper */
+#define RECLAIM_USECS 2000
+
+static struct wait_queue *queue;
+static volatile int stop;
+static volatile int ndirtied; /* sleepers that have dirtied their stack */
+
+static void
+dirty(int depth)
+{
+	volatile char frame[1024];
+
+	frame[0] = depth;
+	if (depth > 0) {
+		dirty(depth - 1);
+	}
+	frame[sizeof(frame) - 1] = frame[0];
+}
+
+static void
+sleeper_thread(void *arg)
+{
+	volatile long live[64];
+	int ii;
+
+	for (ii = 0; ii < 64; ii++) {
+		live[ii] = ii * (long)arg;
+	}
+	dirty(DIRTY / 1024);
+	ndirtied++;
+	thread_sleep(queue);
+	for (ii = 0; ii < 64; ii++) {
+		assert(live[ii] == ii * (long)arg);
+	}
+}
+
+static void
+spinner_thread(void *arg)
+{
+	while (!stop)
+		;
+}
+
+static long
+committed()
+{
+	struct thread_stack_usage usage;
+
+	thread_stack_usage(&usage);
+	return usage.committed;
+}
+
+static void
+check_reclaimed(const char *how, long before, long after)
+{
+	unintr_printf("%s: %ld KB committed before, %ld KB after\n", how,
+		      before / 1024, after / 1024);
+	if (before < DIRTY || after > KEEP) {
+		unintr_printf("test_reclaim: error, %s reclaim did not give the "
+			      "stack back\n", how);
+		assert(0);
+	}
+}
+
+static void
+test_reclaim()
+{
+	struct thread_stack_usage usage;
+	long before, reclaimed;
+	Tid sleeper, spinner, ret;
+
+	unintr_printf("starting reclaim test\n");
+	queue = wait_queue_create();
+
+	/* on demand */
+	sleeper = thread_create(sleeper_thread, (void *)3);
+	assert(thread_ret_ok(sleeper));
+	ret = thread_yield(sleeper);
+	assert(ret == sleeper);
+	before = committed();
+	reclaimed = thread_reclaim_stacks();
+	check_reclaimed("on demand", before, committed());
+	assert(reclaimed >= DIRTY - KEEP);
+	thread_stack_usage(&usage);
+	assert(usage.reclaimed == reclaimed);
+	assert(thread_reclaim_stacks() == 0);
+	assert(thread_wakeup(queue, 0) == 1);
+	assert(thread_wait(sleeper, NULL) == sleeper);
+
+	/* by policy, while another thread keeps the timer going */
+	sleeper = thread_create(sleeper_thread, (void *)5);
+	assert(thread_ret_ok(sleeper));
+	ret = thread_yield(sleeper);
+	assert(ret == sleeper);
+	before = committed();
+	register_interrupt_handler(false);
+	spinner = thread_create(spinner_thread, NULL);
+	assert(thread_ret_ok(spinner));
+	spin(10 * RECLAIM_USECS);
+	check_reclaimed("by policy", before, committed());
+	stop = 1;
+	assert(thread_wait(spinner, NULL) == spinner);
+	assert(thread_wakeup(queue, 0) == 1);
+	assert(thread_wait(sleeper, NULL) == sleeper);
+
+	/* by policy, with the initial thread alone */
+	sleeper = thread_create(sleeper_thread, (void *)7);
+	assert(thread_ret_ok(sleeper));
+	/* the timer is still on, and may preempt it */
+	while (ndirtied < 3) {
+		thread_yield(sleeper);
+	}
+	before = committed();
+	spin(10 * RECLAIM_USECS);
+	check_reclaimed("alone", before, committed());
+	assert(thread_wakeup(queue, 0) == 1);
+	assert(thread_wait(sleeper, NULL) == sleeper);
+
+	wait_queue_destroy(queue);
+	unintr_printf("reclaim test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_options options = { 0 };
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library, with mmap stacks that are reclaimed
+	 * after a thread has slept for RECLAIM_USECS */
+	options.stack_size = STACK_SIZE;
+	options.stack_mmap = 1;
+	options.stack_reclaim_usecs = RECLAIM_USECS;
+	thread_init_options(&options);
+
+	test_reclaim();
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Checks the mmap stacks. A thread with a large stack only commits the pages
+ * it touches, and a thread that overflows its stack faults on the guard page
+ * right below it, instead of running on into the stack of the thread below.
+ * The overflow is done in a child process.
+ *****************************************************************************/
+
+#define STACK_SIZE (1024 * 1024)
+
+static struct wait_queue *queue;
+static char *overflow_top;
+
+static void
+small_thread(void *arg)
+{
+	volatile char frame[4096];
+
+	frame[0] = 1;
+	frame[sizeof(frame) - 1] = frame[0];
+	thread_sleep(queue);
+}
+
+static long
+overflow(long depth)
+{
+	volatile char frame[1024];
+
+	frame[0] = depth;
+	if (depth > 2 * STACK_SIZE / sizeof(frame)) {
+		/* ran past the end of the stack without faulting */
+		return 0;
+	}
+	return overflow(depth + 1) + frame[0];
+}
+
+static void
+overflow_thread(void *arg)
+{
+	char top;
+
+	overflow_top = &top;
+	overflow(0);
+}
+
+/* Runs on its own stack, since the faulting one is used up. */
+static void
+overflow_handler(int sig, siginfo_t *info, void *ucontext)
+{
+	char *bottom = overflow_top - STACK_SIZE;
+	char *addr = info->si_addr;
+	long page = sysconf(_SC_PAGESIZE);
+
+	_exit(addr >= bottom - 2 * page && addr < bottom + page ? 0 : 1);
+}
+
+static void
+test_lazy_commit()
+{
+	struct thread_stack_usage usage;
+	Tid ret;
+
+	ret = thread_create(small_thread, NULL);
+	assert(thread_ret_ok(ret));
+	ret = thread_yield(ret);
+	assert(thread_ret_ok(ret));
+
+	thread_stack_usage(&usage);
+	assert(usage.stacks == 1);
+	assert(usage.reserved > STACK_SIZE);
+	if (usage.committed > 64 * 1024) {
+		unintr_printf("test_stack_guard: error, %ld bytes of the stack "
+			      "are committed\n", usage.committed);
+		assert(0);
+	}
+	ret = thread_wakeup(queue, 1);
+	assert(ret == 1);
+	thread_yield(THREAD_ANY);
+	thread_stack_usage(&usage);
+	assert(usage.stacks == 0);
+}
+
+static void
+test_guard()
+{
+	int status;
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		struct sigaction action = { 0 };
+		stack_t altstack;
+		Tid ret;
+
+		altstack.ss_sp = malloc(SIGSTKSZ);
+		altstack.ss_size = SIGSTKSZ;
+		altstack.ss_flags = 0;
+		sigaltstack(&altstack, NULL);
+		action.sa_sigaction = overflow_handler;
+		action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+		sigaction(SIGSEGV, &action, NULL);
+
+		/* Stacks are mapped top down: the second one sits right below
+		 * the first, and would be overwritten without the guard. */
+		ret = thread_create(overflow_thread, NULL);
+		assert(thread_ret_ok(ret));
+		assert(thread_ret_ok(thread_create(small_thread, NULL)));
+		thread_yield(ret);
+		_exit(2);
+	}
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		unintr_printf("test_stack_guard: error, stack overflow did not "
+			      "fault on the guard page\n");
+		assert(0);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_options options = { 0 };
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library, with large mmap stacks */
+	options.stack_size = STACK_SIZE;
+	options.stack_mmap = 1;
+	thread_init_options(&options);
+
+	unintr_printf("starting stack guard test\n");
+	queue = wait_queue_create();
+	test_lazy_commit();
+	test_guard();
+	wait_queue_destroy(queue);
+	unintr_printf("stack guard test done\n");
+	return 0;
+}
@@ -0,0 +1,239 @@
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Runs threads on several kernel threads at once. Threads add to a counter
+ * under a lock, and hand a token around with condition variables, while
+ * timer interrupts preempt them. No update may be lost, thread_id() must
+ * stay right as threads move between kernel threads, and more than one
+ * kernel thread must have run them. Then a thread is killed while it spins,
+ * most likely on another kernel thread. Last, in child processes, the initial
+ * thread exits or sleeps while another thread still runs: the process must
+ * still end once that thread is done.
+ *****************************************************************************/
+
+#define NWORKERS 4
+#define NCHILD 16
+#define ITERATIONS 2000
+#define PASSES 200 /* times the token goes round */
+#define CHILD_TIMEOUT 10 /* secs before a child process counts as hung */
+
+static struct lock *lock;
+static struct cv *cv;
+static long counter;
+static int turn;
+static pid_t kernel_tids[NWORKERS * 4];
+static int nkernel_tids;
+static volatile int spinning;
+static struct wait_queue *queue;
+static volatile int last_started;
+
+/* Records the kernel thread we run on. Call with the lock held. */
+static void
+note_kernel_thread()
+{
+	pid_t me = syscall(SYS_gettid);
+	int ii;
+
+	for (ii = 0; ii < nkernel_tids; ii++) {
+		if (kernel_tids[ii] == me) {
+			return;
+		}
+	}
+	assert(nkernel_tids < NWORKERS * 4);
+	kernel_tids[nkernel_tids++] = me;
+}
+
+static void
+test_counter_thread(void *arg)
+{
+	Tid me = thread_id();
+	int ii;
+
+	for (ii = 0; ii < ITERATIONS; ii++) {
+		lock_acquire(lock);
+		counter++;
+		note_kernel_thread();
+		lock_release(lock);
+		/* work outside the lock, for the other workers to take part */
+		spin(5);
+		if (ii % 100 == 0) {
+			thread_yield(THREAD_ANY);
+		}
+		assert(thread_id() == me);
+	}
+}
+
+static void
+test_token_thread(void *arg)
+{
+	long num = (long)arg;
+	int ii;
+
+	lock_acquire(lock);
+	for (ii = 0; ii < PASSES; ii++) {
+		while (turn != num) {
+			cv_wait(cv, lock);
+		}
+		turn = (turn + 1) % NCHILD;
+		cv_broadcast(cv, lock);
+	}
+	lock_release(lock);
+}
+
+static void
+test_spin_thread(void *arg)
+{
+	spinning = 1;
+	while (1)
+		;
+}
+
+/* Runs for a while after the initial thread has gone, then wakes it. */
+static void
+test_last_thread(void *arg)
+{
+	last_started = 1;
+	spin(20000);
+	if (queue != NULL) {
+		thread_wakeup(queue, 1);
+	}
+}
+
+static void
+run_all(void (*fn)(void *))
+{
+	Tid child[NCHILD];
+	Tid ret;
+	long ii;
+
+	for (ii = 0; ii < NCHILD; ii++) {
+		child[ii] = thread_create(fn, (void *)ii);
+		assert(thread_ret_ok(child[ii]));
+	}
+	for (ii = 0; ii < NCHILD; ii++) {
+		ret = thread_wait(child[ii], NULL);
+		assert(ret == child[ii]);
+	}
+}
+
+static void
+test_workers()
+{
+	Tid ret;
+	int exit_code;
+
+	unintr_printf("starting workers test\n");
+	lock = lock_create();
+	cv = cv_create();
+
+	run_all(test_counter_thread);
+	if (counter != (long)NCHILD * ITERATIONS) {
+		unintr_printf("test_workers: error, counter is %ld, expected "
+			      "%ld\n", counter, (long)NCHILD * ITERATIONS);
+		assert(0);
+	}
+	unintr_printf("counter threads ran on %d kernel threads\n",
+		      nkernel_tids);
+	if (nkernel_tids < 2) {
+		unintr_printf("test_workers: error, one kernel thread ran all "
+			      "threads\n");
+		assert(0);
+	}
+
+	run_all(test_token_thread);
+	assert(turn == 0);
+
+	ret = thread_create(test_spin_thread, NULL);
+	assert(thread_ret_ok(ret));
+	while (!spinning) {
+		thread_yield(THREAD_ANY);
+	}
+	assert(thread_kill(ret) == ret);
+	/* If it was running elsewhere, it dies a little later, and we wait */
+	exit_code = 0;
+	if (thread_wait(ret, &exit_code) == ret) {
+		assert(exit_code == -SIGKILL);
+	}
+	assert(thread_kill(ret) == THREAD_INVALID);
+
+	cv_destroy(cv);
+	lock_destroy(lock);
+	unintr_printf("workers test done\n");
+}
+
+/* In a child process of its own, the initial thread exits, or sleeps until
+ * woken, before the last other thread is done. */
+static void
+test_initial_first(bool sleep)
+{
+	struct thread_options options = { 0 };
+	int status, polls;
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		init_csc369_malloc(false);
+		options.workers = NWORKERS;
+		thread_init_options(&options);
+		register_interrupt_handler(false);
+		if (sleep) {
+			queue = wait_queue_create();
+		}
+		assert(thread_ret_ok(thread_create(test_last_thread, NULL)));
+		/* give the CPU up, for an idle worker to take it */
+		while (!last_started) {
+			usleep(1000);
+		}
+		if (sleep) {
+			/* the other thread runs elsewhere: nobody to switch to */
+			assert(thread_sleep(queue) == thread_id());
+			exit(0);
+		}
+		thread_exit(0);
+		_exit(2);
+	}
+	for (polls = 0; polls < CHILD_TIMEOUT * 10; polls++) {
+		if (waitpid(pid, &status, WNOHANG) == pid) {
+			break;
+		}
+		usleep(100000);
+	}
+	if (polls == CHILD_TIMEOUT * 10) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+		unintr_printf("test_workers: error, process hung after the "
+			      "initial thread %s\n", sleep ? "slept" : "exited");
+		assert(0);
+	}
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct thread_options options = { 0 };
+
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* These set the library up in child processes, before we do. */
+	test_initial_first(false);
+	test_initial_first(true);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	options.workers = NWORKERS;
+	thread_init_options(&options);
+	/* Register interrupt handler & start timer interrupts. */
+	register_interrupt_handler(false);
+
+	test_workers();
+	return 0;
+}
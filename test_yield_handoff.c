@@ -0,0 +1,108 @@
+#include "malloc369.h"
+#include "common.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "test_thread.h"
+
+/******************************************************************************
+ * Checks the directed handoff done by thread_yield(tid). The target leaves the
+ * ready queue and the calling thread takes its place, so the other ready
+ * threads keep their turn and repeated directed yields do not grow the queue.
+ *****************************************************************************/
+
+#define NCHILD 3
+#define PINGPONGS 100000
+
+static Tid child[NCHILD];
+static int order[16];
+static int norder;
+
+static void
+test_handoff_thread(int num)
+{
+	while (1) {
+		order[norder++] = num;
+		thread_yield(THREAD_ANY);
+	}
+}
+
+static Tid main_tid;
+static long pongs;
+
+static void
+test_pingpong_thread(void *arg)
+{
+	while (1) {
+		pongs++;
+		thread_yield(main_tid);
+	}
+}
+
+static void
+test_handoff()
+{
+	static const int expected[] = { 1, 0, 2, 1, 0 };
+	Tid ret;
+	long ii;
+	int jj;
+
+	unintr_printf("starting yield handoff test\n");
+	main_tid = thread_id();
+
+	for (jj = 0; jj < NCHILD; jj++) {
+		child[jj] = thread_create((void (*)(void *))test_handoff_thread,
+					  (void *)(long)jj);
+		assert(thread_ret_ok(child[jj]));
+	}
+	/* ready queue: 0 1 2. Run 1 directly, we take its place: 0 main 2 */
+	ret = thread_yield(child[1]);
+	assert(ret == child[1]);
+	/* 1 ran, then 0, and now we are back: ready queue is 2 1 0 */
+	ret = thread_yield(THREAD_ANY);
+	assert(ret == child[2]);
+
+	assert(norder == 5);
+	for (jj = 0; jj < norder; jj++) {
+		if (order[jj] != expected[jj]) {
+			unintr_printf("test_handoff: thread %d ran at position "
+				      "%d, expected %d\n",
+				      order[jj], jj, expected[jj]);
+			assert(0);
+		}
+	}
+	for (jj = 0; jj < NCHILD; jj++) {
+		ret = thread_kill(child[jj]);
+		assert(ret == child[jj]);
+	}
+
+	/* Without the handoff, every directed yield left one more entry behind
+	 * in the ready queue. */
+	ret = thread_create(test_pingpong_thread, NULL);
+	assert(thread_ret_ok(ret));
+	for (ii = 0; ii < PINGPONGS; ii++) {
+		Tid ret2 = thread_yield(ret);
+		assert(ret2 == ret);
+	}
+	assert(pongs == PINGPONGS);
+	ret = thread_kill(ret);
+	assert(thread_ret_ok(ret));
+	ret = thread_yield(THREAD_ANY);
+	assert(ret == THREAD_NONE);
+
+	unintr_printf("yield handoff test done\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Catch fatal signals in case thread functions crash. */
+	install_fatal_handlers((void *)main);
+	/* Initialize malloc tracking */
+	init_csc369_malloc(false);
+	/* Initialize threads library */
+	thread_init();
+
+	/* Cooperative only: the test checks the exact order threads run in. */
+	test_handoff();
+	return 0;
+}
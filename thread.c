@@ -2,10 +2,21 @@
 #include <stdlib.h>
 #include <ucontext.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include "thread.h"
+#include "common.h"
 #include "stdbool.h"
 #include "interrupt.h"
 #include "malloc369.h"
+#include "context.h"
+#include "stack.h"
 
 #define ERR_EMPTY -2
 //enum {
@@ -48,14 +59,56 @@ typedef enum State{
     Sleep,
 } state_t;
 
+typedef struct queue{
+    int current_size;
+    Tid head;
+    Tid tail;
+} queue_t;
+
+/* The part of the thread control block the scheduler reads on every queue
+ * operation and every tick. It lives in a table of its own, apart from the
+ * saved registers, so walking queues only pulls in these small records. */
+typedef struct thread_sched {
+    /* Queues are linked through the threads on them. A thread is on at most
+     * one queue at a time: the ready queue or one wait queue. */
+    struct queue * queue; /* the queue we are on, NULL if none */
+    Tid next;
+    Tid prev;
+    state_t state;
+    int priority; /* THREAD_PRIO_HIGHEST to THREAD_PRIO_LOWEST */
+    int level; /* the ready queue we go on, 0 is served first */
+    int boost_gen; /* MLFQ: boost_gen when level was last brought up to date */
+    long quantum; /* time slice in usecs */
+    long slice_left; /* usecs left of the current time slice */
+    long vruntime; /* fair scheduling: ns run, scaled by 1024 / weight */
+    long deadline; /* EDF: absolute, in ns of CLOCK_MONOTONIC, 0 if none */
+} thread_sched_t;
+
 /* This is the thread control block. */
 typedef struct thread {
-    ucontext_t ucontext;
+    struct context context;
     long long * stack_start;
+    size_t stack_size;
+    bool stack_from_caller; /* given in thread_attr, we do not free it */
+    /* Copy-stack mode: the thread runs on shared_stack, and while another
+     * thread uses it, the live part of its frames waits in saved_stack. */
+    bool stack_shared;
+    char * saved_stack;
+    size_t saved_size;
+    size_t saved_capacity;
+    /* Lazy stacks: until the thread first runs, it has no stack and these
+     * say what to set it up with. */
+    void (*start_fn)(void *);
+    void * start_arg;
+    char name[THREAD_NAME_MAX];
+    int sleep_pass; /* reclaim_pass when the thread went to sleep */
+    bool stack_reclaimed; /* since it went to sleep */
     bool is_main;
-    state_t state;
-    int waiter;
+    bool on_cpu; /* running on one of the workers */
+    struct worker * worker; /* the one it runs on, while on_cpu in M:N mode */
+    bool killed; /* by thread_kill while it ran on another worker */
     int exit_code;
+    struct queue waiters; /* the thread in thread_wait() on us, if any */
 
 
 	/* ... Fill this in ... */
@@ -63,136 +116,843 @@ typedef struct thread {
 
 
 
-typedef struct queue{
-    int current_size;
-    int start;
-    int end;
-    int threads[THREAD_MAX_THREADS * 30];
-} queue_t;
-
 /* This is the wait queue structure, needed for Assignment 2. */
 struct wait_queue {
     queue_t queue;
 };
 
-thread_t threads[THREAD_MAX_THREADS];
-queue_t thread_queue;
-int current_thread;
-int thread_to_destroy = -1;
-bool administrative_mode = false;
+/* The thread tables are reserved for max_threads up front, so a Tid indexes
+ * them directly and they never move. Their pages are only committed as slots
+ * get used, and slots are only initialized when they are first handed out. */
+thread_sched_t * sched;
+thread_t * threads;
+int max_threads;
+int threads_used; /* slots below this one have been initialized */
+/* A scheduling policy orders the ready threads that have no deadline: threads
+ * with one always run first, earliest deadline first. */
+struct policy {
+    int levels; /* ready queues in ready_queues it uses, 0 if none */
+    void (*init)(void);
+    /* ready thread tid joins the run queue */
+    void (*enqueue)(Tid tid);
+    /* takes the thread to run next off the run queue, or returns -1 */
+    Tid (*dequeue_next)(void);
+    /* the current thread ran for usecs more: returns true to preempt it */
+    bool (*on_tick)(long usecs);
+    /* tid was just created or woken up, and is about to be enqueued */
+    void (*on_wakeup)(Tid tid);
+    /* the current thread is going to sleep */
+    void (*on_block)(void);
+    /* tid was just created, or its priority changed */
+    void (*on_priority)(Tid tid);
+    /* the current thread is about to be switched out */
+    void (*on_switch_out)(void);
+};
 
-int queue_index(queue_t queue, int index){
-    if (index >= queue.current_size){
-        return -1;
+const struct policy * policy;
+
+/* Ready queues for the policies that run threads in levels, 0 first. FIFO
+ * only uses the first, MLFQ the first MLFQ_LEVELS, and PRIO one per
+ * priority. */
+#define PRIO_LEVELS (THREAD_PRIO_LOWEST - THREAD_PRIO_HIGHEST + 1)
+#define MLFQ_LEVELS 8
+#define MLFQ_BOOST_USECS 100000 /* everyone back to their starting level */
+queue_t ready_queues[PRIO_LEVELS];
+/* By the clock, not by counting ticks: every worker ticks, and a boost is for
+ * all of them. */
+long boost_next_ns; /* now_ns() of the next boost */
+int boost_gen; /* MLFQ: one more at every boost */
+/* A min-heap of ready threads, on a field of their thread_sched. Threads in
+ * it point their queue at the heap's, which only counts them, and keep their
+ * index in slots in next. */
+typedef struct heap {
+    queue_t queue; /* first, so that a queue pointer gives the heap */
+    Tid * slots;
+    size_t key; /* offset of the long to order by in thread_sched_t */
+} heap_t;
+
+/* Fair scheduling keeps the ready threads in a heap on vruntime instead. */
+heap_t fair_heap = { .key = offsetof(thread_sched_t, vruntime) };
+/* Threads with a deadline are ready in this heap, whatever the scheduler, and
+ * run before all the others. */
+heap_t edf_heap = { .key = offsetof(thread_sched_t, deadline) };
+struct thread_deadline_stats deadline_stats;
+long min_vruntime; /* never goes back, new and woken threads start here */
+/* Each worker runs a thread of its own, -1 while it has none. */
+__thread long run_start_ns; /* cpu_now_ns() when the current thread was last
+                             * charged */
+__thread int current_thread;
+long default_quantum;
+size_t default_stack_size;
+bool lazy_stacks;
+/* Reclaiming the stacks of sleeping threads. At the first tick after every
+ * reclaim_interval usecs, by the clock as for the MLFQ boost, a pass gives
+ * back the pages of threads that have slept since before the previous pass. */
+long reclaim_interval;
+long reclaim_next_ns; /* now_ns() of the next pass */
+int reclaim_pass;
+/* The timer keeps going, even with nothing to preempt, until reclaim_pass
+ * gets here: by then every thread that is still asleep has been reclaimed. */
+int reclaim_until_pass;
+long stack_bytes_reclaimed;
+/* Threads that exited and still hold their stack and tid. A thread cannot
+ * free the stack it runs on, so whoever runs next frees them all. */
+queue_t dead_queue;
+/* M:N mode: nworkers kernel threads, the workers, run the threads. Worker 0
+ * is the one that called thread_init. A worker with no thread to run goes back
+ * to its idle context, and waits there for one to be ready. All the state
+ * above is shared by the workers: disabling interrupts also takes a lock
+ * around it, see interrupts_use_lock(). */
+#define IDLE_STACK (64 * 1024) /* signal frames land here too */
+struct worker {
+    pthread_t pthread;
+    struct context idle_context;
+};
+struct worker * workers;
+int nworkers = 1;
+__thread struct worker * this_worker;
+int busy_workers; /* running a thread, 1 without M:N */
+int idle_workers; /* waiting for idle_seq to change */
+unsigned int idle_seq;
+
+void queue_init(queue_t * queue){
+    queue->current_size = 0;
+    queue->head = -1;
+    queue->tail = -1;
+}
+
+void print_queue(queue_t * queue){
+    interrupts_off();
+    unintr_printf("reachedprint\n");
+    unintr_printf("size: %d\n ", queue->current_size);
+//    for (Tid tid = queue->head; tid != -1; tid = sched[tid].next){
+//        unintr_printf("thread number: %d threadstatus: %d\n", tid, sched[tid].state);
+//    }
+    unintr_printf("\n");
+//    interrupts_on();
+}
+
+void queue_push(queue_t * queue, Tid tid){
+    thread_sched_t * thread = &sched[tid];
+    assert(thread->queue == NULL);
+    thread->queue = queue;
+    thread->next = -1;
+    thread->prev = queue->tail;
+    if (queue->tail == -1){
+        queue->head = tid;
+    } else {
+        sched[queue->tail].next = tid;
+    }
+    queue->tail = tid;
+    queue->current_size += 1;
+}
+
+/* Takes tid off whatever queue it is on, in O(1). */
+void queue_remove(Tid tid){
+    thread_sched_t * thread = &sched[tid];
+    queue_t * queue = thread->queue;
+    assert(queue != NULL);
+    if (thread->prev == -1){
+        queue->head = thread->next;
+    } else {
+        sched[thread->prev].next = thread->next;
+    }
+    if (thread->next == -1){
+        queue->tail = thread->prev;
+    } else {
+        sched[thread->next].prev = thread->prev;
+    }
+    thread->queue = NULL;
+    queue->current_size -= 1;
+}
+
+/* new_tid takes old_tid's place in its queue, and old_tid leaves it. */
+void queue_replace(Tid old_tid, Tid new_tid){
+    thread_sched_t * old = &sched[old_tid];
+    thread_sched_t * new = &sched[new_tid];
+    queue_t * queue = old->queue;
+    assert(queue != NULL && new->queue == NULL);
+    new->queue = queue;
+    new->prev = old->prev;
+    new->next = old->next;
+    if (old->prev == -1){
+        queue->head = new_tid;
+    } else {
+        sched[old->prev].next = new_tid;
     }
-    int offset = index + queue.start;
-    if (offset < THREAD_MAX_THREADS){
-        return offset;
+    if (old->next == -1){
+        queue->tail = new_tid;
     } else {
-        return offset - THREAD_MAX_THREADS;
+        sched[old->next].prev = new_tid;
+    }
+    old->queue = NULL;
+}
+
+int queue_pop(queue_t * queue){
+    if (queue->current_size == 0){
+        return ERR_EMPTY;
+    }
+    Tid result = queue->head;
+    queue_remove(result);
+    return result;
+}
+
+/* Threads on a wait queue are asleep, so any other queue is a ready one. */
+bool is_ready(Tid tid){
+    return sched[tid].queue != NULL && sched[tid].state == Running;
+}
+
+/* The level a thread with this priority starts at: the priorities are split
+ * evenly over the levels of the policy. */
+int base_level(int priority){
+    return (priority - THREAD_PRIO_HIGHEST) * policy->levels / PRIO_LEVELS;
+}
+
+/* The best level with a ready thread on it, or policy->levels if none. */
+int best_ready_level(){
+    int level = 0;
+    while (level < policy->levels && ready_queues[level].current_size == 0){
+        level++;
+    }
+    return level;
+}
+
+/* Moves tid to a new level, and to the end of that level's queue if it is
+ * ready. */
+void set_level(Tid tid, int level){
+    int old = sched[tid].level;
+    if (old == level){
+        return;
     }
+    sched[tid].level = level;
+    if (sched[tid].queue == &ready_queues[old]){
+        queue_remove(tid);
+        queue_push(&ready_queues[level], tid);
+    }
+}
+
+/* CPU weight of each priority, as in Linux: every step is about 1.25x. */
+static const int prio_weights[THREAD_PRIO_LOWEST - THREAD_PRIO_HIGHEST + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15,
 };
+#define WEIGHT_DEFAULT 1024
 
-int next(int index){
-    int offset = index + 1;
-    if (offset < THREAD_MAX_THREADS * 30){
-        return offset;
-    } else if (offset > THREAD_MAX_THREADS * 30){
-//        exit(0);
-        return -1;
+long heap_key(heap_t * heap, Tid tid){
+    return *(long *)((char *)&sched[tid] + heap->key);
+}
+
+void heap_set(heap_t * heap, int index, Tid tid){
+    heap->slots[index] = tid;
+    sched[tid].next = index;
+}
+
+void heap_sift_up(heap_t * heap, int index){
+    Tid tid = heap->slots[index];
+    while (index > 0){
+        int parent = (index - 1) / 2;
+        if (heap_key(heap, heap->slots[parent]) <= heap_key(heap, tid)){
+            break;
+        }
+        heap_set(heap, index, heap->slots[parent]);
+        index = parent;
+    }
+    heap_set(heap, index, tid);
+}
+
+void heap_sift_down(heap_t * heap, int index){
+    int size = heap->queue.current_size;
+    Tid tid = heap->slots[index];
+    while (2 * index + 1 < size){
+        int child = 2 * index + 1;
+        if (child + 1 < size && heap_key(heap, heap->slots[child + 1]) <
+                                heap_key(heap, heap->slots[child])){
+            child++;
+        }
+        if (heap_key(heap, tid) <= heap_key(heap, heap->slots[child])){
+            break;
+        }
+        heap_set(heap, index, heap->slots[child]);
+        index = child;
+    }
+    heap_set(heap, index, tid);
+}
+
+void heap_push(heap_t * heap, Tid tid){
+    assert(sched[tid].queue == NULL);
+    sched[tid].queue = &heap->queue;
+    heap->queue.current_size++;
+    heap_set(heap, heap->queue.current_size - 1, tid);
+    heap_sift_up(heap, heap->queue.current_size - 1);
+}
+
+void heap_remove(heap_t * heap, Tid tid){
+    int index = sched[tid].next;
+    assert(sched[tid].queue == &heap->queue && heap->slots[index] == tid);
+    sched[tid].queue = NULL;
+    heap->queue.current_size--;
+    if (index == heap->queue.current_size){
+        return;
+    }
+    /* the last thread fills the hole, and moves whichever way it must */
+    Tid last = heap->slots[heap->queue.current_size];
+    heap_set(heap, index, last);
+    heap_sift_up(heap, index);
+    if (sched[last].next == index){
+        heap_sift_down(heap, index);
+    }
+}
+
+/* The thread at the top, or -1 if the heap is empty. */
+Tid heap_top(heap_t * heap){
+    return heap->queue.current_size != 0 ? heap->slots[0] : -1;
+}
+
+/* Whether the policy has a ready thread: one without a deadline. */
+bool policy_has_ready(void){
+    if (policy->levels == 0){
+        /* fair */
+        return heap_top(&fair_heap) != -1;
+    }
+    return best_ready_level() < policy->levels;
+}
+
+/* CPU time of the calling kernel thread. Fair scheduling charges this rather
+ * than wall time: time the process spends preempted by the OS is not charged
+ * to whichever thread happened to be running. */
+long cpu_now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* Charges the current thread for the time since it was last charged. */
+void fair_charge(void){
+    if (current_thread < 0){
+        /* an idle worker has nobody to charge */
+        return;
+    }
+    long now = cpu_now_ns();
+    thread_sched_t * current = &sched[current_thread];
+    int weight = prio_weights[current->priority - THREAD_PRIO_HIGHEST];
+    current->vruntime += (now - run_start_ns) * WEIGHT_DEFAULT / weight;
+    run_start_ns = now;
+    long floor = current->vruntime;
+    Tid top = heap_top(&fair_heap);
+    if (top != -1 && sched[top].vruntime < floor){
+        floor = sched[top].vruntime;
+    }
+    if (floor > min_vruntime){
+        min_vruntime = floor;
+    }
+}
+
+/* Takes tid off the ready queue or wait queue it is on. */
+void dequeue(Tid tid){
+    queue_t * queue = sched[tid].queue;
+    if (queue == &fair_heap.queue || queue == &edf_heap.queue){
+        heap_remove((heap_t *)queue, tid);
     } else {
-        return 0;
+        queue_remove(tid);
     }
 }
 
-int prev(int index){
-    int offset = index - 1;
-    if (offset >= 0){
-        return offset;
-    } else if (offset < -1){
-//        exit(0);
-        return -1;
+/* Whether ready thread tid should run before the current thread. */
+bool edf_before(Tid tid){
+    return sched[current_thread].deadline == 0 ||
+           sched[tid].deadline < sched[current_thread].deadline;
+}
+
+/* The current thread is done with the work its deadline was for. */
+void deadline_done(){
+    thread_sched_t * current = &sched[current_thread];
+    if (current->deadline == 0){
+        return;
+    }
+    long late = now_ns() - current->deadline;
+    if (late > 0){
+        deadline_stats.missed++;
+        if (late > deadline_stats.max_late_ns){
+            deadline_stats.max_late_ns = late;
+        }
     } else {
-        return THREAD_MAX_THREADS * 30 - 1;
+        deadline_stats.met++;
     }
+    current->deadline = 0;
 }
 
-void print_queue(queue_t queue){
-    interrupts_off();
-    unintr_printf("reachedprint\n");
-    unintr_printf("size: %d\n ", queue.current_size);
-//    int start = queue.start;
-//    int end = queue.end;
-//    while (start != end){
-//        unintr_printf("thread number: %d threadstatus: %d\n", queue.threads[start], threads[queue.threads[start]].state);
-//        start = next(start);
-//    }
-    unintr_printf("\n");
-//    interrupts_on();
+void ready_push(Tid tid){
+    if (sched[tid].deadline != 0){
+        heap_push(&edf_heap, tid);
+    } else {
+        policy->enqueue(tid);
+    }
+    /* Someone besides the running thread can run: preemption is needed. */
+    interrupts_arm();
+    if (idle_workers > 0){
+        idle_seq++;
+        syscall(SYS_futex, &idle_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/**************************************************************************
+ * Scheduling policies
+ **************************************************************************/
+void * table_reserve(size_t size);
+
+void policy_nop(void){
+}
+
+void policy_nop_tid(Tid tid){
 }
 
-bool queue_push(queue_t * queue, int value){
-    if (queue->current_size == THREAD_MAX_THREADS * 30){
-//        exit(0);
+/* Counts usecs against the current thread's slice. Once it is used up,
+ * returns true and starts a new one. */
+bool slice_used_up(long usecs){
+    thread_sched_t * current = &sched[current_thread];
+    current->slice_left -= usecs;
+    if (current->slice_left > 0){
         return false;
     }
-    queue->threads[queue->end] = value;
-    queue->end = next(queue->end);
-    queue->current_size += 1;
+    /* If nobody else can run we keep the CPU for another full slice. */
+    current->slice_left = current->quantum;
     return true;
 }
 
-int queue_pop_last(queue_t * queue){
-    if (queue->current_size == 0){
-        return ERR_EMPTY;
+void level_enqueue(Tid tid){
+    queue_push(&ready_queues[sched[tid].level], tid);
+}
+
+Tid level_dequeue_next(void){
+    int level = best_ready_level();
+    if (level == policy->levels){
+        return -1;
     }
-    queue->end = prev(queue->end);
-    queue->current_size -= 1;
-    return queue->threads[queue->end];
+    return queue_pop(&ready_queues[level]);
 }
 
-int queue_pop(queue_t * queue){
-    if (queue->current_size == 0){
-        return ERR_EMPTY;
+/* At the end of a slice: go round robin with the threads on our level or a
+ * better one, while those on worse levels wait. With nobody ready at all,
+ * the yield finds that out and the timer can stop. */
+bool level_slice_over(void){
+    int best = best_ready_level();
+    return best <= sched[current_thread].level || best == policy->levels;
+}
+
+/* The thread goes to the level its priority maps to. */
+void level_on_priority(Tid tid){
+    set_level(tid, base_level(sched[tid].priority));
+}
+
+/* FIFO: one queue, round robin. */
+bool fifo_on_tick(long usecs){
+    return slice_used_up(usecs);
+}
+
+static const struct policy fifo_policy = {
+    .levels = 1,
+    .init = policy_nop,
+    .enqueue = level_enqueue,
+    .dequeue_next = level_dequeue_next,
+    .on_tick = fifo_on_tick,
+    .on_wakeup = policy_nop_tid,
+    .on_block = policy_nop,
+    .on_priority = policy_nop_tid,
+    .on_switch_out = policy_nop,
+};
+
+/* Priority: a level per priority, round robin in each level. A ready thread
+ * on a better level preempts the running one at the next tick. */
+bool prio_on_tick(long usecs){
+    if (!slice_used_up(usecs)){
+        /* a better thread woke up: it goes first */
+        return best_ready_level() < sched[current_thread].level;
+    }
+    return level_slice_over();
+}
+
+static const struct policy prio_policy = {
+    .levels = PRIO_LEVELS,
+    .init = policy_nop,
+    .enqueue = level_enqueue,
+    .dequeue_next = level_dequeue_next,
+    .on_tick = prio_on_tick,
+    .on_wakeup = policy_nop_tid,
+    .on_block = policy_nop,
+    .on_priority = level_on_priority,
+    .on_switch_out = policy_nop,
+};
+
+/* MLFQ: priority levels, with feedback. A thread drops a level when it uses
+ * up its slice and climbs back when it sleeps, and every MLFQ_BOOST_USECS
+ * everyone goes back to their starting level. */
+
+/* Sends tid back to its starting level if there was a boost since its level
+ * was last brought up to date. */
+void mlfq_catch_up(Tid tid){
+    if (sched[tid].boost_gen != boost_gen){
+        sched[tid].boost_gen = boost_gen;
+        set_level(tid, base_level(sched[tid].priority));
+    }
+}
+
+/* Only the ready threads move at a boost. The others catch up when they are
+ * next enqueued, charged a tick or blocked. */
+void mlfq_boost(void){
+    boost_gen++;
+    for (int level = 1; level < MLFQ_LEVELS; level++){
+        Tid tid = ready_queues[level].head;
+        while (tid != -1){
+            /* it can only move to a queue we are done with */
+            Tid next = sched[tid].next;
+            mlfq_catch_up(tid);
+            tid = next;
+        }
+    }
+}
+
+void mlfq_enqueue(Tid tid){
+    mlfq_catch_up(tid);
+    level_enqueue(tid);
+}
+
+void mlfq_init(void){
+    boost_next_ns = now_ns() + MLFQ_BOOST_USECS * 1000L;
+}
+
+bool mlfq_on_tick(long usecs){
+    long now = now_ns();
+    if (now >= boost_next_ns){
+        boost_next_ns = now + MLFQ_BOOST_USECS * 1000L;
+        mlfq_boost();
+    }
+    mlfq_catch_up(current_thread);
+    if (!slice_used_up(usecs)){
+        /* a better thread woke up: it goes first, we keep our level */
+        return best_ready_level() < sched[current_thread].level;
+    }
+    if (sched[current_thread].level < MLFQ_LEVELS - 1){
+        /* used up its slice: demote */
+        sched[current_thread].level++;
+    }
+    return level_slice_over();
+}
+
+void mlfq_on_block(void){
+    thread_sched_t * current = &sched[current_thread];
+    mlfq_catch_up(current_thread);
+    if (current->level > base_level(current->priority)){
+        /* gave up the CPU on its own: promote */
+        current->level--;
+    }
+}
+
+void mlfq_on_priority(Tid tid){
+    sched[tid].boost_gen = boost_gen;
+    level_on_priority(tid);
+}
+
+static const struct policy mlfq_policy = {
+    .levels = MLFQ_LEVELS,
+    .init = mlfq_init,
+    .enqueue = mlfq_enqueue,
+    .dequeue_next = level_dequeue_next,
+    .on_tick = mlfq_on_tick,
+    .on_wakeup = policy_nop_tid,
+    .on_block = mlfq_on_block,
+    .on_priority = mlfq_on_priority,
+    .on_switch_out = policy_nop,
+};
+
+/* Fair: the thread with the least vruntime runs next. */
+void fair_init(void){
+    fair_heap.slots = table_reserve(max_threads * sizeof(Tid));
+    run_start_ns = cpu_now_ns();
+}
+
+void fair_enqueue(Tid tid){
+    heap_push(&fair_heap, tid);
+}
+
+Tid fair_dequeue_next(void){
+    Tid tid = heap_top(&fair_heap);
+    if (tid != -1){
+        heap_remove(&fair_heap, tid);
+    }
+    return tid;
+}
+
+bool fair_on_tick(long usecs){
+    if (!slice_used_up(usecs)){
+        return false;
+    }
+    fair_charge();
+    /* keep going if nobody is further behind than us */
+    Tid top = heap_top(&fair_heap);
+    return top == -1 || sched[top].vruntime < sched[current_thread].vruntime;
+}
+
+void fair_on_wakeup(Tid tid){
+    /* brings min_vruntime up to date, the timer may have been off */
+    fair_charge();
+    if (sched[tid].vruntime < min_vruntime){
+        /* no credit for time spent asleep */
+        sched[tid].vruntime = min_vruntime;
+    }
+}
+
+static const struct policy fair_policy = {
+    .levels = 0,
+    .init = fair_init,
+    .enqueue = fair_enqueue,
+    .dequeue_next = fair_dequeue_next,
+    .on_tick = fair_on_tick,
+    .on_wakeup = fair_on_wakeup,
+    .on_block = policy_nop,
+    .on_priority = policy_nop_tid,
+    .on_switch_out = fair_charge,
+};
+
+/* Indexed by thread_options.scheduler. */
+static const struct policy * const policies[] = {
+    [THREAD_SCHED_FIFO] = &fifo_policy,
+    [THREAD_SCHED_MLFQ] = &mlfq_policy,
+    [THREAD_SCHED_FAIR] = &fair_policy,
+    [THREAD_SCHED_PRIO] = &prio_policy,
+};
+
+/* Free tids are kept in a bitmap, with a summary bitmap on top of it and so
+ * on up to a single word: bit i of a word is set if word i of the level
+ * below has a free tid in it. Finding the lowest free tid reads one word per
+ * level, and so does taking or freeing a tid. */
+#define TID_WORDS(n) (((n) + 63) / 64)
+#define FREE_TID_LEVELS 4
+
+unsigned long * free_tids[FREE_TID_LEVELS]; /* free_tids[0] has a bit per tid */
+int free_tid_levels;
+
+void tid_free(Tid tid){
+    assert(!(free_tids[0][tid / 64] & (1UL << (tid % 64))));
+    for (int level = 0; level < free_tid_levels; level++){
+        unsigned long * word = &free_tids[level][tid / 64];
+        bool was_empty = *word == 0;
+        *word |= 1UL << (tid % 64);
+        if (!was_empty){
+            break;
+        }
+        tid /= 64;
+    }
+}
+
+/* Takes the lowest free tid, or returns THREAD_NOMORE. */
+Tid tid_alloc(){
+    if (free_tids[free_tid_levels - 1][0] == 0){
+        return THREAD_NOMORE;
+    }
+    Tid tid = 0;
+    for (int level = free_tid_levels - 1; level >= 0; level--){
+        tid = tid * 64 + __builtin_ctzl(free_tids[level][tid]);
+    }
+    Tid result = tid;
+    for (int level = 0; level < free_tid_levels; level++){
+        unsigned long * word = &free_tids[level][tid / 64];
+        *word &= ~(1UL << (tid % 64));
+        if (*word != 0){
+            break;
+        }
+        tid /= 64;
     }
-    int result = queue->threads[queue->start];
-    queue->start = next(queue->start);
-    queue->current_size -= 1;
     return result;
 }
 
+/* Reserves zeroed memory that is only committed when it is touched. It is
+ * not counted by malloc369, and it lives as long as the process. */
+void * table_reserve(size_t size){
+    void * table = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(table != MAP_FAILED);
+    return table;
+}
+
+void free_tids_init(){
+    size_t nwords = 0;
+    int n = max_threads;
+    free_tid_levels = 0;
+    do {
+        assert(free_tid_levels < FREE_TID_LEVELS);
+        free_tid_levels++;
+        nwords += TID_WORDS(n);
+        n = TID_WORDS(n);
+    } while (n > 1);
+    unsigned long * words = table_reserve(nwords * sizeof(*words));
+    n = max_threads;
+    for (int level = 0; level < free_tid_levels; level++){
+        free_tids[level] = words;
+        words += TID_WORDS(n);
+        n = TID_WORDS(n);
+    }
+    /* tid 0 is the initial thread, and it is never handed out again */
+    for (Tid tid = 1; tid < max_threads; tid++){
+        tid_free(tid);
+    }
+}
+
+/* Copy-stack mode. Threads without a stack of their own all run on
+ * shared_stack. The thread whose frames are on it is the occupant. Before
+ * another shared-stack thread runs, the copier, on a small stack of its own,
+ * copies the live part of the occupant's frames, from its saved stack pointer
+ * up to the top, out to a buffer sized to fit. Then it copies the next
+ * thread's frames back in. Frames always go back to the addresses they were
+ * saved from, so pointers into them stay valid while their thread runs, but
+ * not while it is switched out. */
+#define COPIER_STACK (64 * 1024) /* signal frames land here too */
+
+char * shared_stack;
+size_t shared_stack_size;
+Tid occupant = -1;
+Tid copy_to; /* the thread the copier switches to next */
+struct context copier_context;
+
+void save_frames(Tid tid){
+    thread_t * thread = &threads[tid];
+    char * top = shared_stack + shared_stack_size;
+    char * sp = context_sp(&thread->context);
+    size_t size = top - sp;
+    assert(sp >= shared_stack && sp <= top);
+    if (size > thread->saved_capacity){
+        free369(thread->saved_stack);
+        /* a little room, so that slightly deeper frames still fit */
+        thread->saved_capacity = (size + 255) & ~(size_t)255;
+        thread->saved_stack = malloc369(thread->saved_capacity);
+    }
+    memcpy(thread->saved_stack, sp, size);
+    thread->saved_size = size;
+}
+
+void copier_main(void (*unused)(void *), void *unused_arg){
+    while (true){
+        assert(!interrupts_enabled());
+        if (occupant != -1){
+            save_frames(occupant);
+        }
+        thread_t * thread = &threads[copy_to];
+        memcpy(shared_stack + shared_stack_size - thread->saved_size,
+               thread->saved_stack, thread->saved_size);
+        occupant = copy_to;
+        context_switch(&copier_context, &thread->context);
+    }
+}
+
+void shared_stack_init(size_t size){
+    shared_stack_size = size;
+    shared_stack = table_reserve(size);
+    void * copier_stack = table_reserve(COPIER_STACK);
+    context_init(&copier_context, copier_stack, COPIER_STACK, copier_main,
+                 NULL, NULL);
+}
+
 /**************************************************************************
  * Assignment 1: Refer to thread.h for the detailed descriptions of the six
  *               functions you need to implement. 
  **************************************************************************/
+/* Slots at threads_used and above have never held a thread. */
 bool is_valid_thread(Tid tid){
-    return tid >= 0 && tid < THREAD_MAX_THREADS;
+    return tid >= 0 && tid < threads_used;
+}
+
+void thread_slot_init(Tid tid){
+    assert(tid == threads_used);
+    sched[tid].state = Destroyed;
+    queue_init(&threads[tid].waiters);
+    threads[tid].exit_code = -SIGKILL;
+    sched[tid].queue = NULL;
+    threads_used++;
 }
 void
 handle_death(int thread_to_die);
 void
+reap_dead(void);
+void
+workers_start(int n);
+void
+exit_current(int exit_code);
+void
 thread_init(void)
 {
-    assert(thread_queue.current_size == 0);
-    assert(thread_queue.start == 0);
-    assert(thread_queue.end == 0);
-    thread_queue.start = 0;
-    thread_queue.end = 0;
-    thread_queue.current_size = 0;
+    thread_init_options(NULL);
+}
+
+void
+thread_init_options(const struct thread_options *options)
+{
+    default_quantum = SIG_INTERVAL;
+    if (options != NULL && options->quantum_usecs > 0){
+        default_quantum = options->quantum_usecs;
+    }
+    max_threads = THREAD_MAX_THREADS;
+    if (options != NULL && options->max_threads > 0){
+        max_threads = options->max_threads;
+    }
+    default_stack_size = THREAD_MIN_STACK;
+    if (options != NULL && options->stack_size > THREAD_MIN_STACK){
+        default_stack_size = options->stack_size;
+    }
+    stack_use_mmap(options != NULL && options->stack_mmap);
+    lazy_stacks = options != NULL && options->stack_lazy;
+    if (options != NULL && options->stack_shared){
+        shared_stack_init(default_stack_size);
+    }
+    reclaim_interval = 0;
+    if (options != NULL && options->stack_reclaim_usecs > 0){
+        reclaim_interval = options->stack_reclaim_usecs;
+        reclaim_next_ns = now_ns() + reclaim_interval * 1000;
+    }
+    stack_pool_set_max(options != NULL && options->stack_pool_max > 0 ?
+                       options->stack_pool_max : 0);
+    assert(threads == NULL);
+    int n = options != NULL && options->workers > 1 ? options->workers : 1;
+    /* there is only the one shared stack */
+    assert(n == 1 || shared_stack == NULL);
+    if (n > 1){
+        interrupts_use_lock();
+    }
+    int scheduler = options != NULL ? options->scheduler : THREAD_SCHED_FIFO;
+    assert(scheduler >= 0 &&
+           scheduler < (int)(sizeof(policies) / sizeof(*policies)));
+    policy = policies[scheduler];
+    for (int level = 0; level < PRIO_LEVELS; level++){
+        assert(ready_queues[level].current_size == 0);
+        queue_init(&ready_queues[level]);
+    }
+    queue_init(&dead_queue);
     interrupts_off();
-    for (int i = 0; i < THREAD_MAX_THREADS; i++){
-        thread_t uncreated_thread = {0};
-        uncreated_thread.state = Destroyed;
-        uncreated_thread.waiter = -1;
-        uncreated_thread.exit_code = -SIGKILL;
-        threads[i] = uncreated_thread;
-    }
-    thread_t main_thread;
-    main_thread.is_main = true;
+    sched = table_reserve(max_threads * sizeof(thread_sched_t));
+    assert(fair_heap.queue.current_size == 0);
+    queue_init(&fair_heap.queue);
+    assert(edf_heap.queue.current_size == 0);
+    queue_init(&edf_heap.queue);
+    edf_heap.slots = table_reserve(max_threads * sizeof(Tid));
+    threads = table_reserve(max_threads * sizeof(thread_t));
+    free_tids_init();
+    thread_slot_init(0);
     current_thread = 0;
-    main_thread.state = Running;
-    main_thread.waiter = -1;
-    threads[0] = main_thread;
+    threads[0].is_main = true;
+    threads[0].on_cpu = true;
+    sched[0].state = Running;
+    sched[0].quantum = default_quantum;
+    sched[0].slice_left = default_quantum;
+    policy->init();
+    policy->on_priority(0);
+    busy_workers = 1;
+    if (n > 1){
+        workers_start(n);
+    }
     interrupts_on();
     assert(interrupts_enabled());
 	/* Add necessary initialization for your threads library here. */
@@ -212,107 +972,249 @@ thread_id()
 void
 thread_stub(void (*thread_main)(void *), void *arg)
 {
+        reap_dead();
         interrupts_on();
         thread_main(arg); // call thread_main() function with arg
         thread_exit(0);
 }
 
+void
+thread_attr_init(struct thread_attr *attr)
+{
+    memset(attr, 0, sizeof(*attr));
+}
+
 Tid
 thread_create(void (*fn) (void *), void *parg)
 {
+    return thread_create_attr(NULL, fn, parg);
+}
+
+Tid
+thread_create_attr(const struct thread_attr *attr, void (*fn) (void *), void *parg)
+{
+    struct thread_attr defaults;
+    if (attr == NULL){
+        thread_attr_init(&defaults);
+        attr = &defaults;
+    }
+    if ((attr->stack_size != 0 && attr->stack_size < THREAD_MIN_ATTR_STACK) ||
+        (attr->stack != NULL && attr->stack_size == 0) ||
+        attr->priority < THREAD_PRIO_HIGHEST ||
+        attr->priority > THREAD_PRIO_LOWEST || attr->quantum_usecs < 0){
+        return THREAD_INVALID;
+    }
     bool signal_state = interrupts_set(false);
     assert(!interrupts_enabled());
     assert(signal_state);
-	int thread_num_to_create = 1;
-    bool found = false;
-    for (; thread_num_to_create < THREAD_MAX_THREADS; thread_num_to_create ++){
-        if (threads[thread_num_to_create].state == Destroyed){
-            found = true;
-            break;
-        }
-    }
-    if (found == false){
+	int thread_num_to_create = tid_alloc();
+    if (thread_num_to_create == THREAD_NOMORE){
         interrupts_set(signal_state);
         return THREAD_NOMORE;
     }
+    if (thread_num_to_create == threads_used){
+        thread_slot_init(thread_num_to_create);
+    }
+    assert(sched[thread_num_to_create].state == Destroyed);
 
-    void * stack_pointer = malloc369(THREAD_MIN_STACK);
-    ucontext_t new_thread_context = {0};
-    void * stack_start = stack_pointer + THREAD_MIN_STACK - 8;
-    thread_t new_thread = {0};
-    new_thread.stack_start = stack_pointer;
-    new_thread.state = Running;
-    new_thread.waiter = -1;
-    new_thread.exit_code = -SIGKILL;
+    size_t stack_size = attr->stack_size ? attr->stack_size : default_stack_size;
+    void * stack_pointer = attr->stack;
+    /* Only threads that ask for nothing special share the run stack. */
+    bool shared = shared_stack != NULL && attr->stack == NULL &&
+                  attr->stack_size == 0;
+    if (shared){
+        stack_pointer = shared_stack;
+        stack_size = shared_stack_size;
+    } else if (stack_pointer == NULL && !lazy_stacks){
+        stack_pointer = stack_alloc(&stack_size);
+    }
+    if (stack_pointer == NULL && !lazy_stacks){
+        tid_free(thread_num_to_create);
+        interrupts_set(signal_state);
+        return THREAD_NOMEMORY;
+    }
+    /* Fill in the TCB where it lives instead of building it on our stack and
+     * copying it over. */
+    thread_t * new_thread = &threads[thread_num_to_create];
+    new_thread->stack_start = stack_pointer;
+    new_thread->stack_size = stack_size;
+    new_thread->stack_from_caller = attr->stack != NULL;
+    new_thread->stack_shared = shared;
+    new_thread->saved_stack = NULL;
+    new_thread->saved_size = 0;
+    new_thread->saved_capacity = 0;
+    new_thread->start_fn = fn;
+    new_thread->start_arg = parg;
+    new_thread->name[0] = '\0';
+    if (attr->name != NULL){
+        strncpy(new_thread->name, attr->name, THREAD_NAME_MAX - 1);
+        new_thread->name[THREAD_NAME_MAX - 1] = '\0';
+    }
+    new_thread->is_main = false;
+    new_thread->on_cpu = false;
+    new_thread->killed = false;
+    assert(new_thread->waiters.current_size == 0);
+    new_thread->exit_code = -SIGKILL;
+    sched[thread_num_to_create].state = Running;
+    sched[thread_num_to_create].priority = attr->priority;
+    sched[thread_num_to_create].level = 0;
+    sched[thread_num_to_create].vruntime = 0;
+    sched[thread_num_to_create].deadline = 0;
+    sched[thread_num_to_create].quantum = attr->quantum_usecs ?
+                                          attr->quantum_usecs : default_quantum;
     assert(!interrupts_enabled());
-    getcontext(&new_thread_context);
-
-    new_thread_context.uc_mcontext.gregs[15] = (greg_t) stack_start;
-    new_thread_context.uc_mcontext.gregs[16] = (long long)&thread_stub;
-    new_thread_context.uc_mcontext.gregs[8] = (long long)fn;
-    new_thread_context.uc_mcontext.gregs[9] = (long long)parg;
-
-    new_thread.ucontext = new_thread_context;
+    if (stack_pointer != NULL){
+        context_init(&new_thread->context, stack_pointer, stack_size,
+                     thread_stub, fn, parg);
+    }
 
-    threads[thread_num_to_create]= new_thread;
-    queue_push(&thread_queue, thread_num_to_create);
+    policy->on_priority(thread_num_to_create);
+    policy->on_wakeup(thread_num_to_create);
+    ready_push(thread_num_to_create);
 
     interrupts_set(signal_state);
 	return thread_num_to_create;
 }
 
 int get_thread_any(int current){
-    while (true){
-        int result = queue_pop(&thread_queue);
-        if (result == -2){
+    Tid result = heap_top(&edf_heap);
+    if (result != -1){
+        heap_remove(&edf_heap, result);
+    } else {
+        result = policy->dequeue_next();
+        if (result == -1){
             return THREAD_NONE;
         }
-        if (threads[result].state == Running && result != current){
-            return result;
-        }
     }
+    /* Killed threads leave the queue as they die, so there is nothing
+     * stale to skip. */
+    assert(sched[result].state == Running && result != current);
+    return result;
 }
 
-void admin_mode(){
-    assert(!interrupts_enabled());
-//    assert(thread_to_destroy == thread_id());
-    thread_kill(thread_id());
-    administrative_mode = false;
-    thread_to_destroy = -1;
-//    interrupts_on();
+/* With lazy stacks, a thread gets its stack when it is first dispatched. If
+ * there is no memory for it, the thread dies with exit code THREAD_NOMEMORY
+ * and false is returned. */
+bool stack_setup(Tid tid){
+    thread_t * thread = &threads[tid];
+    if (thread->stack_start != NULL || thread->is_main){
+        return true;
+    }
+    size_t size = thread->stack_size;
+    void * stack = stack_alloc(&size);
+    if (stack == NULL){
+        thread->exit_code = THREAD_NOMEMORY;
+        handle_death(tid);
+        return false;
+    }
+    thread->stack_start = stack;
+    thread->stack_size = size;
+    context_init(&thread->context, stack, size, thread_stub, thread->start_fn,
+                 thread->start_arg);
+    return true;
+}
+
+bool running_elsewhere(Tid tid){
+    return tid != current_thread && threads[tid].on_cpu;
+}
 
+/* Switches from the current thread, which is asleep or dead, to the idle
+ * context of this worker. Returns once some worker runs the thread again. */
+void switch_to_idle(void){
+    Tid prev_tid = current_thread;
+    policy->on_switch_out();
+    current_thread = -1;
+    threads[prev_tid].on_cpu = false;
+    /* this worker stops running threads, whichever one it dispatched */
+    busy_workers--;
+    context_switch(&threads[prev_tid].context, &this_worker->idle_context);
     assert(!interrupts_enabled());
-    assert(current_thread != 0);
-    int cur = current_thread;
-    assert(threads[current_thread].state == Destroyed);
-    int result = thread_yield(THREAD_ANY);
-
-    unintr_printf("result: %d\ncurrent_thread: %d\n", result, cur);
-    if (THREAD_NONE == result){
-        exit(0);
-    }
-    assert(false);
-//    int result = get_thread_any(-1);
-//    if (THREAD_NONE == result){
-//        if (threads[0].state == Running){
-//            setcontext(&threads[0].ucontext);
-//        }
-//        exit(0);
-//    } else {
-//        setcontext(&threads[result].ucontext);
-//    }
+    reap_dead();
+}
+
+/* The idle context of a worker: runs the next ready thread, or waits for one
+ * while interrupts are on. It runs on the worker's own stack, and only ever
+ * on its own worker. */
+void worker_main(void (*unused)(void *), void *unused_arg){
+    while (true){
+        assert(!interrupts_enabled());
+        reap_dead();
+        Tid next;
+        do {
+            next = get_thread_any(-1);
+        } while (next != THREAD_NONE && !stack_setup(next));
+        if (next == THREAD_NONE){
+            unsigned int seen = idle_seq;
+            idle_workers++;
+            interrupts_on();
+            syscall(SYS_futex, &idle_seq, FUTEX_WAIT_PRIVATE, seen, NULL,
+                    NULL, 0);
+            interrupts_off();
+            idle_workers--;
+            continue;
+        }
+        current_thread = next;
+        threads[next].on_cpu = true;
+        threads[next].worker = this_worker;
+        sched[next].slice_left = sched[next].quantum;
+        run_start_ns = cpu_now_ns();
+        busy_workers++;
+        /* we may have stopped our timer while idle */
+        interrupts_arm();
+        context_switch(&this_worker->idle_context, &threads[next].context);
+    }
 }
-int counter = 0;
+
+void * worker_start(void * arg){
+    this_worker = arg;
+    current_thread = -1;
+    interrupts_off();
+    worker_main(NULL, NULL);
+    return NULL;
+}
+
+/* Starts workers 1 to n - 1. The caller becomes worker 0, whose idle context
+ * gets a stack of its own: the caller's runs the initial thread. */
+void workers_start(int n){
+    nworkers = n;
+    workers = table_reserve(n * sizeof(struct worker));
+    workers[0].pthread = pthread_self();
+    this_worker = &workers[0];
+    threads[current_thread].worker = this_worker;
+    context_init(&workers[0].idle_context, table_reserve(IDLE_STACK),
+                 IDLE_STACK, worker_main, NULL, NULL);
+    for (int i = 1; i < n; i++){
+        int ret = pthread_create(&workers[i].pthread, NULL, worker_start,
+                                 &workers[i]);
+        assert(ret == 0);
+    }
+}
+
 Tid
 thread_yield(Tid want_tid)
 {
     bool signal_state = interrupts_set(false);
     Tid actual_tid;
+    if (threads[current_thread].killed){
+        exit_current(-SIGKILL);
+    }
     if (want_tid == THREAD_SELF || want_tid == current_thread){
         interrupts_set(signal_state);
         return current_thread;
     } else if (want_tid == THREAD_ANY) {
-        int result = get_thread_any(thread_id());
+        int result;
+        do {
+            result = get_thread_any(thread_id());
+        } while (result != THREAD_NONE && !stack_setup(result));
+        if (result == THREAD_NONE && sched[current_thread].state != Running &&
+            busy_workers > 1){
+            /* Going to sleep or exiting, while a thread that may wake us up
+             * still runs on another worker: this one goes idle. Nobody was
+             * switched to, and thread_sleep returns our own tid. */
+            switch_to_idle();
+            interrupts_set(signal_state);
+            return current_thread;
+        }
         if (result == THREAD_NONE) {
             interrupts_set(signal_state);
             return THREAD_NONE;
@@ -322,57 +1224,342 @@ thread_yield(Tid want_tid)
         actual_tid = want_tid;
     }
     assert(!interrupts_enabled());
-    if (actual_tid >= THREAD_MAX_THREADS || actual_tid < 0){
+    if (!is_valid_thread(actual_tid)){
         interrupts_set(signal_state);
         return THREAD_INVALID;
     }
-    state_t state = threads[actual_tid].state;
+    state_t state = sched[actual_tid].state;
     if (state == Destroyed){
         interrupts_set(signal_state);
         return THREAD_INVALID;
     }
-    volatile bool switched = false;
-    ucontext_t current_context = {0};
+    if (running_elsewhere(actual_tid)){
+        /* it already has a CPU, there is nothing to hand it */
+        interrupts_set(signal_state);
+        return actual_tid;
+    }
+    if (!stack_setup(actual_tid)){
+        interrupts_set(signal_state);
+        return THREAD_NOMEMORY;
+    }
+    /* The interrupt state is not part of the saved context: we switch with
+     * interrupts off and restore signal_state from our own frame once we are
+     * switched back in. */
     assert(!interrupts_enabled());
-    getcontext(&current_context);
-    if (switched){
-        assert(!interrupts_enabled());
-        assert(!interrupts_enabled());
-        if (administrative_mode){
-            assert(current_thread == thread_to_destroy);
-            assert(!interrupts_enabled());
-//            if (current_thread != 0){
-//            }
-            admin_mode();
-        } else{
-            assert(!interrupts_enabled());
-            interrupts_set(signal_state);
-            return actual_tid;
+    Tid prev_tid = current_thread;
+    bool ready = is_ready(actual_tid);
+    /* before the caller goes back in a run queue */
+    policy->on_switch_out();
+    if (sched[prev_tid].state != Running){
+        /* sleeping or exiting, the caller does not go back in the queue */
+        if (ready){
+            dequeue(actual_tid);
         }
-//        interrupts_set(signal_state);
-//        return actual_tid;
-//        assert(false);
+    } else if (sched[prev_tid].deadline == 0 &&
+               sched[actual_tid].queue == &ready_queues[sched[prev_tid].level]){
+        /* Directed handoff: the caller takes the target's place in the ready
+         * queue. The target leaves the queue in O(1), the queue does not grow,
+         * and every other ready thread keeps its turn. */
+        queue_replace(actual_tid, prev_tid);
+    } else {
+        /* the target's place, if any, is on another queue than ours, or in
+         * a heap */
+        if (ready){
+            dequeue(actual_tid);
+        }
+        ready_push(prev_tid);
+    }
+    current_thread = actual_tid;
+    threads[prev_tid].on_cpu = false;
+    threads[actual_tid].on_cpu = true;
+    threads[actual_tid].worker = this_worker;
+    sched[actual_tid].slice_left = sched[actual_tid].quantum;
+    if (threads[actual_tid].stack_shared && occupant != actual_tid){
+        /* its frames are not on the shared stack: the copier puts them back */
+        copy_to = actual_tid;
+        context_switch(&threads[prev_tid].context, &copier_context);
+    } else {
+        context_switch(&threads[prev_tid].context, &threads[actual_tid].context);
     }
-    switched = true;
     assert(!interrupts_enabled());
-    threads[current_thread].ucontext = current_context;
+    reap_dead();
+    interrupts_set(signal_state);
+    return actual_tid;
+}
 
-    queue_push(&thread_queue, current_thread);
-    current_thread = actual_tid;
-    setcontext(&threads[actual_tid].ucontext);
-    assert(false);
+/* Whether reclaim_stacks may give back part of tid's stack while it sleeps. */
+bool stack_reclaimable(Tid tid){
+    thread_t * thread = &threads[tid];
+    return !thread->is_main && !thread->stack_from_caller &&
+           !thread->stack_shared;
+}
+
+/* The current thread is about to switch out to sleep. */
+void sleep_current(){
+    deadline_done();
+    sched[current_thread].state = Sleep;
+    policy->on_block();
+    threads[current_thread].sleep_pass = reclaim_pass;
+    threads[current_thread].stack_reclaimed = false;
+    if (reclaim_interval > 0 && stack_reclaimable(current_thread)){
+        /* it is reclaimed at the second pass from now */
+        reclaim_until_pass = reclaim_pass + 2;
+        interrupts_arm();
+    }
+}
+
+/* Gives back the dead part of the stacks of sleeping threads: everything below
+ * the stack pointer they were switched out with. With all false, only threads
+ * that have slept through a whole pass interval are reclaimed. */
+long reclaim_stacks(bool all){
+    assert(!interrupts_enabled());
+    long reclaimed = 0;
+    for (Tid tid = 0; tid < threads_used; tid++){
+        thread_t * thread = &threads[tid];
+        if (sched[tid].state != Sleep || tid == current_thread ||
+            !stack_reclaimable(tid) || thread->stack_reclaimed){
+            continue;
+        }
+        if (!all && thread->sleep_pass == reclaim_pass){
+            continue;
+        }
+        reclaimed += stack_reclaim(thread->stack_start, thread->stack_size,
+                                   context_sp(&thread->context));
+        thread->stack_reclaimed = true;
+    }
+    reclaim_pass++;
+    stack_bytes_reclaimed += reclaimed;
+    return reclaimed;
+}
+
+long
+thread_reclaim_stacks(void)
+{
+    bool signal_state = interrupts_off();
+    long reclaimed = reclaim_stacks(true);
+    interrupts_set(signal_state);
+    return reclaimed;
+}
+
+Tid
+thread_tick(long usecs)
+{
+    bool signal_state = interrupts_off();
+    if (current_thread < 0){
+        /* an idle worker: nothing to preempt */
+        interrupts_set(signal_state);
+        return THREAD_NONE;
+    }
+    if (threads[current_thread].killed){
+        exit_current(-SIGKILL);
+    }
+    if (reclaim_interval > 0){
+        long now = now_ns();
+        if (now >= reclaim_next_ns){
+            reclaim_next_ns = now + reclaim_interval * 1000;
+            reclaim_stacks(false);
+        }
+    }
+    Tid edf = heap_top(&edf_heap);
+    if (edf != -1 && edf_before(edf)){
+        /* due sooner than us: it runs now */
+        Tid ret = thread_yield(THREAD_ANY);
+        interrupts_set(signal_state);
+        return ret;
+    }
+    Tid ret;
+    if (sched[current_thread].deadline != 0){
+        /* nothing is due sooner: keep going */
+        sched[current_thread].slice_left = sched[current_thread].quantum;
+        ret = edf == -1 && !policy_has_ready() ? THREAD_NONE : current_thread;
+    } else if (!policy->on_tick(usecs)){
+        ret = current_thread;
+    } else {
+        ret = thread_yield(THREAD_ANY);
+    }
+    if (ret == THREAD_NONE && nworkers > 1){
+        /* Keep the timer going: a thread readied on another worker could
+         * not start it again. */
+        ret = current_thread;
+    }
+    if (ret == THREAD_NONE && reclaim_interval > 0 &&
+        reclaim_pass < reclaim_until_pass){
+        /* nothing to preempt, but sleepers still to reclaim */
+        ret = current_thread;
+    }
+    interrupts_set(signal_state);
+    return ret;
+}
+
+Tid
+thread_set_quantum(Tid tid, long usecs)
+{
+    bool signal_state = interrupts_off();
+    if (tid == THREAD_SELF){
+        tid = current_thread;
+    }
+    if (!is_valid_thread(tid) || sched[tid].state == Destroyed || usecs <= 0){
+        interrupts_set(signal_state);
+        return THREAD_INVALID;
+    }
+    sched[tid].quantum = usecs;
+    if (sched[tid].slice_left > usecs){
+        sched[tid].slice_left = usecs;
+    }
+    interrupts_set(signal_state);
+    return tid;
+}
+
+Tid
+thread_set_priority(Tid tid, int priority)
+{
+    bool signal_state = interrupts_off();
+    if (tid == THREAD_SELF){
+        tid = current_thread;
+    }
+    if (!is_valid_thread(tid) || sched[tid].state == Destroyed ||
+        priority < THREAD_PRIO_HIGHEST || priority > THREAD_PRIO_LOWEST){
+        interrupts_set(signal_state);
+        return THREAD_INVALID;
+    }
+    sched[tid].priority = priority;
+    policy->on_priority(tid);
+    interrupts_set(signal_state);
+    return tid;
+}
+
+Tid
+thread_set_deadline(Tid tid, long deadline_ns)
+{
+    bool signal_state = interrupts_off();
+    if (tid == THREAD_SELF){
+        tid = current_thread;
+    }
+    if (!is_valid_thread(tid) || sched[tid].state == Destroyed ||
+        deadline_ns < 0){
+        interrupts_set(signal_state);
+        return THREAD_INVALID;
+    }
+    if (tid == current_thread){
+        deadline_done();
+    }
+    bool ready = is_ready(tid);
+    if (ready){
+        dequeue(tid);
+    }
+    sched[tid].deadline = deadline_ns;
+    if (ready){
+        ready_push(tid);
+    }
+    interrupts_set(signal_state);
+    return tid;
+}
+
+void
+thread_deadline_stats(struct thread_deadline_stats *stats)
+{
+    bool signal_state = interrupts_off();
+    *stats = deadline_stats;
+    interrupts_set(signal_state);
+}
+
+const char *
+thread_name(Tid tid)
+{
+    if (tid == THREAD_SELF){
+        tid = current_thread;
+    }
+    if (!is_valid_thread(tid) || sched[tid].state == Destroyed ||
+        threads[tid].name[0] == '\0'){
+        return NULL;
+    }
+    return threads[tid].name;
+}
+
+void
+thread_stack_usage(struct thread_stack_usage *usage)
+{
+    bool signal_state = interrupts_off();
+    usage->stacks = 0;
+    usage->reserved = 0;
+    usage->committed = 0;
+    usage->reclaimed = stack_bytes_reclaimed;
+    for (Tid tid = 0; tid < threads_used; tid++){
+        if (sched[tid].state == Destroyed || threads[tid].is_main ||
+            threads[tid].stack_start == NULL){
+            continue;
+        }
+        usage->stacks += 1;
+        if (threads[tid].stack_shared){
+            /* the buffer its frames are saved to */
+            usage->reserved += threads[tid].saved_capacity;
+            usage->committed += threads[tid].saved_capacity;
+            continue;
+        }
+        usage->reserved += threads[tid].stack_size;
+        if (!threads[tid].stack_from_caller){
+            usage->reserved += stack_guard_size();
+        }
+        usage->committed += stack_committed(threads[tid].stack_start,
+                                            threads[tid].stack_size);
+    }
+    interrupts_set(signal_state);
+}
+
+/* Frees what a thread that is not running holds besides its tid. */
+void
+stack_release(Tid tid){
+    if (threads[tid].stack_shared){
+        /* its frames on the shared stack are dead, nothing to save */
+        if (occupant == tid){
+            occupant = -1;
+        }
+        free369(threads[tid].saved_stack);
+    } else if (!threads[tid].stack_from_caller &&
+               threads[tid].stack_start != NULL){
+        stack_free(threads[tid].stack_start, threads[tid].stack_size);
+    }
+}
+
+/* Runs right after every switch, on the stack of the thread switched to. */
+void
+reap_dead(void){
+    assert(!interrupts_enabled());
+    while (dead_queue.current_size != 0){
+        Tid tid = queue_pop(&dead_queue);
+        stack_release(tid);
+        tid_free(tid);
+    }
 }
 
 void
 handle_death(int thread_to_die){
     bool signal_state = interrupts_off();
-    threads[thread_to_die].state = Destroyed;
-    int waiter = threads[thread_to_die].waiter;
-    if (waiter != -1){
-        assert(threads[waiter].state != Running);
-        if (threads[waiter].state == Sleep){
-            threads[waiter].state = Running;
+    sched[thread_to_die].state = Destroyed;
+    if (sched[thread_to_die].queue != NULL){
+        /* killed while ready or asleep: a reused slot must start unlinked */
+        dequeue(thread_to_die);
+    }
+    if (thread_to_die == 0){
+        /* the main thread's stack is not ours, and its tid is never reused */
+    } else if (thread_to_die == current_thread){
+        /* exiting: we are still on its stack */
+        queue_push(&dead_queue, thread_to_die);
+    } else {
+        tid_free(thread_to_die);
+    }
+    /* A killed waiter has already unlinked itself from waiters. */
+    int waiter = queue_pop(&threads[thread_to_die].waiters);
+    if (waiter != ERR_EMPTY){
+        assert(sched[waiter].state == Sleep);
+        sched[waiter].state = Running;
+        policy->on_wakeup(waiter);
 //            threads[waiter].exit_code_storage = threads[]
+        if (current_thread < 0){
+            /* a lazy stack failed in an idle worker, there is no thread to
+             * hand the CPU over from */
+            ready_push(waiter);
+        } else {
             thread_yield(waiter);
         }
     }
@@ -383,42 +1570,57 @@ void
 thread_exit(int exit_code)
 {
     assert(interrupts_enabled());
-    bool signal_state = interrupts_set(false);
-    if (current_thread == 0){
-        threads[current_thread].exit_code = exit_code;
-        handle_death(current_thread);
-        thread_yield(THREAD_ANY);
-    }
-    thread_to_destroy = current_thread;
-//    threads[current_thread].state = Done;
-    administrative_mode = true;
+    interrupts_set(false);
+    exit_current(exit_code);
+}
+
+/* thread_exit, with interrupts off. */
+void
+exit_current(int exit_code)
+{
+    threads[current_thread].killed = false;
+    deadline_done();
     threads[current_thread].exit_code = exit_code;
-    setcontext(&threads[0].ucontext);
-    assert(false);
-    interrupts_set(signal_state);
+    if (occupant == current_thread){
+        /* the copier must not save our dead frames */
+        occupant = -1;
+    }
+    /* Switches straight to a waiter, if there is one. Otherwise to the next
+     * ready thread. Our stack is freed by the thread we switch to. */
+    handle_death(current_thread);
+    thread_yield(THREAD_ANY);
+    /* nothing left to run */
+    exit(0);
 }
 
 Tid
 thread_kill(Tid tid)
 {
     bool signal_state = interrupts_set(false);
-    if (tid == current_thread && !administrative_mode){
+    if (tid == current_thread){
         interrupts_set(signal_state);
         return THREAD_INVALID;
     }
-    if (tid < 0 || tid >= THREAD_MAX_THREADS){
+    if (!is_valid_thread(tid)){
         interrupts_set(signal_state);
         return THREAD_INVALID;
     }
-    if (threads[tid].state == Destroyed){
+    if (sched[tid].state == Destroyed){
         interrupts_set(signal_state);
         return THREAD_INVALID;
     }
+    if (running_elsewhere(tid)){
+        /* Its stack is in use: it exits on its own, at its next tick or
+         * yield. Interrupt its worker to bring that forward. */
+        threads[tid].killed = true;
+        interrupts_kick(threads[tid].worker->pthread);
+        interrupts_set(signal_state);
+        return tid;
+    }
 
     if (tid != 0){
-        free369(threads[tid].stack_start);
+        stack_release(tid);
     }
-    administrative_mode = false;
     handle_death(tid);
     interrupts_set(signal_state);
     return tid;
@@ -436,9 +1638,7 @@ wait_queue_create()
 
 	wq = malloc369(sizeof(struct wait_queue));
 	assert(wq);
-    wq->queue.current_size = 0;
-    wq->queue.start = 0;
-    wq->queue.end = 0;
+    queue_init(&wq->queue);
 	return wq;
 }
 
@@ -459,12 +1659,12 @@ thread_sleep(struct wait_queue *queue)
     }
 //    print_queue(queue->queue);
 //    print_queue(thread_queue);
-    threads[thread_id()].state = Sleep;
+    sleep_current();
     queue_push(&(queue->queue), thread_id());
     int thread_num = thread_yield(THREAD_ANY);
     if (thread_num == THREAD_NONE){
-        threads[thread_id()].state = Running;
-        assert(queue_pop_last(&(queue->queue)) == thread_id());
+        sched[thread_id()].state = Running;
+        queue_remove(thread_id());
         interrupts_set(enabled);
         return THREAD_NONE;
     }
@@ -472,6 +1672,33 @@ thread_sleep(struct wait_queue *queue)
 	return thread_num;
 }
 
+/* Wakes one or all of the threads in queue. A deadline other than 0 is given
+ * to the woken threads. */
+int wakeup(struct wait_queue *queue, int all, long deadline_ns){
+    int num = 0;
+//    print_queue(queue->queue);
+//    print_queue(thread_queue);
+    while (true){
+        int id = queue_pop(&(queue->queue));
+        if (id == ERR_EMPTY){
+            break;
+        }
+        /* Killed sleepers leave the queue as they die. */
+        assert(sched[id].state == Sleep);
+        sched[id].state = Running;
+        if (deadline_ns != 0){
+            sched[id].deadline = deadline_ns;
+        }
+        policy->on_wakeup(id);
+        ready_push(id);
+        num += 1;
+        if (all == 0){
+            break;
+        }
+    }
+    return num;
+}
+
 /* when the 'all' parameter is 1, wakeup all threads waiting in the queue.
  * returns whether a thread was woken up on not. */
 int
@@ -481,25 +1708,22 @@ thread_wakeup(struct wait_queue *queue, int all)
         return 0;
     }
     bool enabled = interrupts_off();
-    int num = 0;
-//    print_queue(queue->queue);
-//    print_queue(thread_queue);
-    while (true){
-        int id = queue_pop(&(queue->queue));
-        if (id == ERR_EMPTY){
-            break;
-        }
-        enum State state = threads[id].state;
-        assert(state != Running);
-        if (state == Sleep){
-            threads[id].state = Running;
-            queue_push(&thread_queue, id);
-            num += 1;
-            if (all == 0){
-                break;
-            }
+    int num = wakeup(queue, all, 0);
+    interrupts_set(enabled);
+	return num;
+}
 
-        }
+int
+thread_wakeup_deadline(struct wait_queue *queue, int all, long deadline_ns)
+{
+    if (queue == NULL || deadline_ns < 0){
+        return 0;
+    }
+    bool enabled = interrupts_off();
+    int num = wakeup(queue, all, deadline_ns);
+    Tid edf = heap_top(&edf_heap);
+    if (edf != -1 && edf_before(edf)){
+        thread_yield(THREAD_ANY);
     }
     interrupts_set(enabled);
 	return num;
@@ -517,7 +1741,7 @@ thread_wait(Tid tid, int *exit_code)
         return THREAD_INVALID;
     }
     // if the thread has been destroyed previously;
-    if (threads[tid].state == Destroyed && threads[tid].exit_code == -SIGKILL){
+    if (sched[tid].state == Destroyed && threads[tid].exit_code == -SIGKILL){
         interrupts_set(signal);
         return THREAD_INVALID;
     }
@@ -525,17 +1749,17 @@ thread_wait(Tid tid, int *exit_code)
         interrupts_set(signal);
         return THREAD_INVALID;
     }
-    if (threads[tid].state != Destroyed){
-        if (threads[tid].waiter != -1){
+    if (sched[tid].state != Destroyed){
+        if (threads[tid].waiters.current_size != 0){
             interrupts_set(signal);
             return THREAD_INVALID;
         }
-        threads[tid].waiter = thread_id();
-        threads[thread_id()].state = Sleep;
+        queue_push(&threads[tid].waiters, thread_id());
+        sleep_current();
         thread_yield(THREAD_ANY);
         assert(!interrupts_enabled());
     }
-//    threads[thread_id()].state = Sleep;
+//    sched[thread_id()].state = Sleep;
     if (exit_code != NULL){
         *exit_code = threads[tid].exit_code;
     }
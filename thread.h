@@ -11,11 +11,27 @@
 
 #define THREAD_MAX_THREADS 1024 /* maximum number of threads */
 #define THREAD_MIN_STACK  32768 /* minimum per-thread execution stack */
+#define THREAD_MIN_ATTR_STACK 8192 /* smallest stack thread_create_attr takes */
+#define THREAD_NAME_MAX 16 /* thread names are cut to this, with the NUL */
+
+/* Thread priorities, as with nice(2): lower values get the CPU first. */
+#define THREAD_PRIO_HIGHEST (-20)
+#define THREAD_PRIO_DEFAULT 0
+#define THREAD_PRIO_LOWEST 19
+
+/* Schedulers for thread_options.scheduler. */
+enum {
+	THREAD_SCHED_FIFO = 0,	/* one ready queue, in arrival order */
+	THREAD_SCHED_MLFQ,	/* multi-level feedback queue */
+	THREAD_SCHED_FAIR,	/* CPU time shared out by priority */
+	THREAD_SCHED_PRIO,	/* static priority levels */
+};
 
 typedef int Tid; /* A thread identifier */
 
 /*
- * Valid thread identifiers (Tid) range between 0 and THREAD_MAX_THREADS-1. The
+ * Valid thread identifiers (Tid) range between 0 and THREAD_MAX_THREADS-1, or
+ * up to the max_threads given to thread_init_options minus one. The
  * first thread to run must have a thread id of 0. Note that this thread is the
  * main thread, i.e., it is created before the first call to thread_create.
  *
@@ -48,6 +64,79 @@ thread_ret_ok(Tid ret)
 /* Perform any initialization needed by your threading system. */
 void thread_init(void);
 
+/* Settings for thread_init_options. Fields that are 0 keep their default. */
+struct thread_options {
+	/* time slice of every thread, in usecs. Default: SIG_INTERVAL */
+	long quantum_usecs;
+	/* most threads alive at once, including the initial thread. The table
+	 * is reserved up front but only uses memory as it fills up. Default:
+	 * THREAD_MAX_THREADS */
+	int max_threads;
+	/* stacks of dead threads kept for reuse, per stack size class. Pooled
+	 * stacks skip malloc369 and free369, but stay allocated. Default: 0,
+	 * every stack is freed */
+	int stack_pool_max;
+	/* size of a thread stack, in bytes. Default: THREAD_MIN_STACK */
+	long stack_size;
+	/* nonzero: reserve stacks with mmap, with an inaccessible guard page
+	 * below each one, and only commit their pages as they are touched.
+	 * Default: stacks come from malloc369 */
+	int stack_mmap;
+	/* nonzero: about every stack_reclaim_usecs, reclaim the stacks of
+	 * threads that have been asleep since the last time, as
+	 * thread_reclaim_stacks does. Default: 0, only on demand */
+	long stack_reclaim_usecs;
+	/* nonzero: threads created without a stack or stack size in their
+	 * thread_attr all run on one shared stack of stack_size bytes. When
+	 * such a thread is switched out and another one needs the stack, the
+	 * live part of its frames is copied out to a buffer just big enough,
+	 * and copied back before it runs again. Parked threads then only cost
+	 * the frames they really use, but switches between them cost a copy,
+	 * and pointers into a thread's stack are only valid while it runs.
+	 * Default: every thread has a stack of its own */
+	int stack_shared;
+	/* nonzero: a thread only gets its stack when it first runs, so a
+	 * thread killed before then never allocates one. If there is no
+	 * memory for the stack by then, the thread exits with exit code
+	 * THREAD_NOMEMORY, and thread_yield to it returns THREAD_NOMEMORY.
+	 * Default: thread_create allocates the stack */
+	int stack_lazy;
+	/* THREAD_SCHED_FIFO, THREAD_SCHED_MLFQ, THREAD_SCHED_FAIR or
+	 * THREAD_SCHED_PRIO.
+	 *
+	 * Under MLFQ, threads start at a level set by their priority, drop a
+	 * level every time they use up a time slice, and climb back one level
+	 * every time they go to sleep. A ready thread at a better level
+	 * preempts the running one at the next tick. Every so often all
+	 * threads go back to their starting level, so that none starves.
+	 *
+	 * Under FAIR, every thread is charged virtual time for the CPU time it
+	 * uses, at a rate that shrinks about 1.25x per step of higher
+	 * priority, and the thread with the least virtual time runs next. A
+	 * thread that wakes up gets no credit for the time it slept.
+	 *
+	 * Under PRIO, every priority is a level of its own, and threads only
+	 * change level when their priority is changed. A ready thread of
+	 * better priority preempts the running one at the next tick, so busy
+	 * threads starve all those of worse priority, even by one step.
+	 *
+	 * Default: THREAD_SCHED_FIFO */
+	int scheduler;
+	/* more than 1: run the threads on this many kernel threads, the
+	 * calling one and workers-1 new ones, so that they can use as many
+	 * CPUs. The library runs on one kernel thread at a time, under a lock
+	 * taken with interrupts off, but the threads' own code runs in
+	 * parallel, and must use locks for the data it shares. Each kernel
+	 * thread has its own timer, and thread_id() is the thread it runs.
+	 * thread_kill on a thread running on another kernel thread returns at
+	 * once, and the thread exits at its next tick or yield. Not with
+	 * stack_shared or INTERRUPT_TIMER_ITIMER. Default: 1 */
+	int workers;
+};
+
+/* Same as thread_init, with process-wide settings. options may be NULL. */
+void thread_init_options(const struct thread_options *options);
+
 
 /* Return the thread identifier of the currently running thread. */
 Tid thread_id(void);
@@ -63,6 +152,39 @@ Tid thread_id(void);
 Tid thread_create(void (*fn) (void *), void *arg);
 
 
+/* Per-thread settings for thread_create_attr. Fields that are 0 or NULL keep
+ * their default. */
+struct thread_attr {
+	/* size of the stack in bytes, at least THREAD_MIN_ATTR_STACK. Default:
+	 * the stack_size given to thread_init_options */
+	long stack_size;
+	/* stack of stack_size bytes for the thread to run on. The caller owns
+	 * it, and must keep it until the thread is gone. Default: the library
+	 * allocates one */
+	void *stack;
+	/* THREAD_PRIO_HIGHEST to THREAD_PRIO_LOWEST. Only priority scheduling
+	 * looks at it. Default: THREAD_PRIO_DEFAULT */
+	int priority;
+	/* time slice in usecs, as with thread_set_quantum. Default: the
+	 * quantum given to thread_init_options */
+	long quantum_usecs;
+	/* name for debugging, copied and cut to THREAD_NAME_MAX. Default: none */
+	const char *name;
+};
+
+/* Clears attr, so that every setting is the default. */
+void thread_attr_init(struct thread_attr *attr);
+
+/* Same as thread_create, with the settings in attr. attr may be NULL. Also
+ * returns THREAD_INVALID if a setting in attr is out of range. */
+Tid thread_create_attr(const struct thread_attr *attr, void (*fn) (void *),
+		       void *arg);
+
+/* Returns the name of thread tid (or THREAD_SELF), or NULL if it has no name
+ * or is not a live thread. */
+const char *thread_name(Tid tid);
+
+
 /* thread_yield should suspend the calling thread and run the thread with
  * identifier tid. The calling thread is put in the ready queue. 
  * tid can be the identifier of any available thread or the following constants:
@@ -110,6 +232,65 @@ void thread_exit(int exit_code);
 Tid thread_kill(Tid tid);
 
 
+/* Set the time slice of thread tid (or THREAD_SELF) to usecs. A thread that
+ * runs for longer than its slice is preempted by the next timer interrupt,
+ * so slices are rounded up to whole SIG_INTERVAL ticks. Returns tid, or
+ * THREAD_INVALID if tid is not a live thread or usecs is not positive.
+ */
+Tid thread_set_quantum(Tid tid, long usecs);
+
+/* Set the priority of thread tid (or THREAD_SELF), THREAD_PRIO_HIGHEST to
+ * THREAD_PRIO_LOWEST. Under MLFQ, the thread also goes back to the level its
+ * priority starts at. Returns tid, or THREAD_INVALID if tid is not a live
+ * thread or priority is out of range.
+ */
+Tid thread_set_priority(Tid tid, int priority);
+
+/* Give thread tid (or THREAD_SELF) an absolute deadline, in ns of
+ * CLOCK_MONOTONIC, or take it away with 0. Whatever the scheduler, ready
+ * threads with a deadline run before all others, earliest deadline first,
+ * and one that is due sooner than the running thread preempts it at the next
+ * tick. A thread is done with its deadline when it sleeps, exits or sets a
+ * new one for itself; it has then met or missed it. Returns tid, or
+ * THREAD_INVALID if tid is not a live thread or deadline_ns is negative.
+ */
+Tid thread_set_deadline(Tid tid, long deadline_ns);
+
+/* Deadlines met and missed so far, over all threads. */
+struct thread_deadline_stats {
+	long met;
+	long missed;
+	long max_late_ns;	/* the worst miss */
+};
+
+void thread_deadline_stats(struct thread_deadline_stats *stats);
+
+
+/* Called by the interrupt handler: charge usecs of CPU time to the current
+ * thread, and preempt it if its time slice is used up. Returns the
+ * identifier of the thread now running, or THREAD_NONE if the slice ran out
+ * but no other thread could run.
+ */
+Tid thread_tick(long usecs);
+
+
+/* Memory taken by the stacks of live threads, other than the initial one. */
+struct thread_stack_usage {
+	long stacks;		/* live thread stacks */
+	long reserved;		/* bytes of address space, guard pages included */
+	long committed;		/* bytes backed by memory right now */
+	long reclaimed;		/* bytes reclaimed from sleeping threads so far */
+};
+
+void thread_stack_usage(struct thread_stack_usage *usage);
+
+/* Gives the memory of the stack pages of sleeping threads that lie below their
+ * saved stack pointer back to the system. Only the pages a sleeping thread can
+ * still return to stay resident. Returns the number of bytes reclaimed.
+ */
+long thread_reclaim_stacks(void);
+
+
 /***************************************************
  * Assignment 2: Implement the following functions *
  **************************************************/
@@ -129,7 +310,10 @@ void wait_queue_destroy(struct wait_queue *wq);
  *
  * Upon success, return the identifier of the thread that was switched to when
  * the calling thread was put to sleep. Note that this function will not return
- * to the calling thread until it runs again later. 
+ * to the calling thread until it runs again later. In M:N mode (see
+ * thread_options.workers), a caller with no other thread ready may wait on
+ * its own kernel thread while one on another kernel thread still runs, and
+ * wake it up: no thread was switched to, and its own identifier is returned.
  * Upon failure, the calling thread continues running, and returns the 
  * following:
  *
@@ -150,6 +334,12 @@ Tid thread_sleep(struct wait_queue *queue);
  */
 int thread_wakeup(struct wait_queue *queue, int all);
 
+/* Same as thread_wakeup, and the woken threads get deadline_ns, as with
+ * thread_set_deadline. If one of them is due sooner than the caller, it runs
+ * right away.
+ */
+int thread_wakeup_deadline(struct wait_queue *queue, int all, long deadline_ns);
+
 
 /* Suspend the current thread until the target thread (i.e., the thread whose 
  * identifier is tid) exits. If the target thread has already exited, then